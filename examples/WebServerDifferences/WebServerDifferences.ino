@@ -204,8 +204,9 @@ void setup() {
         capturedImage.metadata["size"] = StringF("%dx%d", capturedImage.width, capturedImage.height);
         capturedImage.metadata["type"] = "JPG";
         log_i("Converting to RGB");
-        if (rgbImage.hasContent()) prevRgbImage.fromImage(rgbImage).load();
-        if (bmpImage.hasContent()) prevBmpImage.fromImage(bmpImage).load();
+        // Keep the last frame by swapping rather than copying it
+        if (rgbImage.hasContent()) prevRgbImage.swap(rgbImage);
+        if (bmpImage.hasContent()) prevBmpImage.swap(bmpImage);
 
         // Convert captured image to RGB and scale down to 1/4 scale
         rgbImage.fromImage(capturedImage).convertTo(IMAGE_RGB565, SCALING_DIVIDE_4);
@@ -245,6 +246,12 @@ void setup() {
             return false;
           }, noMask);
           log_i("Difference = %f", difference);
+          // Locate the changes as groups of touching 16 x 16 cells in which more than 10% of the pixels differ
+          DiffMap diffMap(16, 16);
+          rgbImage.compareGreyThreshold(prevRgbImage, threshold, diffMap);
+          for (auto& region : diffMap.regions(0.1)) {
+            log_i("Changed region at %d,%d size %dx%d centred on %.0f,%.0f", region.x, region.y, region.width, region.height, region.centroidX, region.centroidY);
+          }
         }
         diffBmpImage.fromImage(diffImage).convertTo(IMAGE_BMP);
         diffImage.metadata["size"] = StringF("%dx%d", diffBmpImage.width, diffBmpImage.height);
@@ -0,0 +1,618 @@
+/*
+** Benchmark of each Image pipeline stage on the host build
+**
+** Every case runs over a fixed, generated corpus so that results are comparable between runs.
+** For each case and image the harness reports time per pixel and what the operation allocated:
+** bytes and allocation count per call, and the peak of live heap above the starting level.
+**
+**   esp_image_bench [--filter <substring>] [--size <WxH>] [--min-ms <n>] [--csv]
+*/
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ftw.h>
+#include <new>
+#include <vector>
+#include "esp_image.h"
+#include "esp_image_writer.h"
+
+// ---- Heap accounting -------------------------------------------------------------------------
+
+static std::atomic<size_t> allocatedBytes(0);
+static std::atomic<size_t> allocationCount(0);
+static std::atomic<size_t> liveBytes(0);
+static std::atomic<size_t> peakLiveBytes(0);
+
+static const size_t HEADER = 16;
+
+static void* trackedAlloc(size_t size) {
+    uint8_t* p = (uint8_t*)malloc(size + HEADER);
+    if (!p) throw std::bad_alloc();
+    *(size_t*)p = size;
+    allocatedBytes += size;
+    allocationCount++;
+    size_t live = (liveBytes += size);
+    size_t peak = peakLiveBytes.load();
+    while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live)) {}
+    return p + HEADER;
+}
+
+static void trackedFree(void* ptr) {
+    if (!ptr) return;
+    uint8_t* p = (uint8_t*)ptr - HEADER;
+    liveBytes -= *(size_t*)p;
+    free(p);
+}
+
+void* operator new(size_t size) { return trackedAlloc(size); }
+void* operator new[](size_t size) { return trackedAlloc(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { try { return trackedAlloc(size); } catch (...) { return nullptr; } }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { try { return trackedAlloc(size); } catch (...) { return nullptr; } }
+void operator delete(void* ptr) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr) noexcept { trackedFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { trackedFree(ptr); }
+
+// ---- Corpus ----------------------------------------------------------------------------------
+
+struct CorpusEntry {
+    const char* pattern;
+    uint16_t width;
+    uint16_t height;
+};
+
+static const CorpusEntry corpus[] = {
+    { "scene", 96, 96 },
+    { "scene", 320, 240 },
+    { "noise", 320, 240 },
+    { "scene", 640, 480 },
+    { "scene", 1600, 1200 },
+};
+
+static uint32_t lcg(uint32_t& seed) {
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 8;
+}
+
+// Big-endian RGB565 as delivered by the camera. 'frame' shifts the scene so consecutive frames differ a little
+static void generateRgb565(const CorpusEntry& entry, int frame, std::vector<uint8_t>& out) {
+    out.resize((size_t)entry.width * entry.height * 2);
+    uint32_t seed = 12345 + frame;
+    bool noise = strcmp(entry.pattern, "noise") == 0;
+    int cx = entry.width / 3 + frame * entry.width / 50;
+    int cy = entry.height / 2;
+    int radius = entry.height / 5;
+    for (int y = 0; y < entry.height; y++) {
+        for (int x = 0; x < entry.width; x++) {
+            int r, g, b;
+            if (noise) {
+                uint32_t v = lcg(seed);
+                r = v & 0xFF;
+                g = (v >> 8) & 0xFF;
+                b = (v >> 16) & 0xFF;
+            } else {
+                r = x * 255 / entry.width;
+                g = y * 255 / entry.height;
+                b = 96;
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) < radius * radius) {
+                    r = 240; g = 220; b = 40;
+                }
+                if (x > entry.width * 2 / 3 && y > entry.height / 4 && y < entry.height * 3 / 4) {
+                    r = g = b = 30;
+                }
+                int n = (int)(lcg(seed) & 7) - 4;
+                r = r + n < 0 ? 0 : r + n > 255 ? 255 : r + n;
+                g = g + n < 0 ? 0 : g + n > 255 ? 255 : g + n;
+            }
+            uint16_t c = (r & 0xF8) << 8 | (g & 0xFC) << 3 | b >> 3;
+            size_t i = 2 * ((size_t)y * entry.width + x);
+            out[i] = c >> 8;
+            out[i + 1] = c & 0xFF;
+        }
+    }
+}
+
+// ---- Cases -----------------------------------------------------------------------------------
+
+struct Fixture {
+    const CorpusEntry* entry;
+    FS* fs;
+    std::vector<uint8_t> rgb565;
+    std::vector<uint8_t> rgb565Next;
+    Image jpeg;
+    Image rgb;
+    Image rgbNext;
+    Image bmp;
+    Image rgb888;
+    Image rgbNative;
+    Image rgbNextNative;
+    Image history;
+    Image frame;
+    Image grey;
+    Image greyNext;
+    Image filtered;
+    IntegralImage integral;
+    Mask circle;
+    String jpegPath;
+    String bmpPath;
+    std::map<String, String> metadata;
+    String metadataJson;
+    ImageWriter writer;
+    ThreadPool pool;    // One worker per core
+};
+
+// Results of pure computations are accumulated here so the compiler cannot discard them
+static volatile double benchSink = 0;
+
+struct BenchCase {
+    const char* name;
+    std::function<void(Fixture&)> run;
+};
+
+static void loadRgb(Image& image, std::vector<uint8_t>& pixels, const CorpusEntry& entry) {
+    image.fromBuffer(pixels.data(), entry.width, entry.height, pixels.size(), IMAGE_RGB565).load();
+}
+
+static void prepareFixture(Fixture& f) {
+    generateRgb565(*f.entry, 0, f.rgb565);
+    generateRgb565(*f.entry, 1, f.rgb565Next);
+    loadRgb(f.rgb, f.rgb565, *f.entry);
+    loadRgb(f.rgbNext, f.rgb565Next, *f.entry);
+    f.circle = Mask(f.entry->width, f.entry->height, insideCircle);
+    f.jpeg.fromImage(f.rgb).convertTo(IMAGE_JPEG);
+    f.bmp.fromImage(f.rgb).convertTo(IMAGE_BMP);
+    f.rgb888.fromImage(f.rgb).convertTo(IMAGE_RGB888);
+    f.rgbNative.setPixelOrder(PIXEL_ORDER_NATIVE);
+    f.rgbNative.fromImage(f.rgb).load();
+    f.rgbNextNative.setPixelOrder(PIXEL_ORDER_NATIVE);
+    f.rgbNextNative.fromImage(f.rgbNext).load();
+    f.grey.fromImage(f.jpeg).convertTo(IMAGE_GRAYSCALE8);
+    Image jpegNext;
+    jpegNext.fromImage(f.rgbNext).convertTo(IMAGE_JPEG);
+    f.greyNext.fromImage(jpegNext).convertTo(IMAGE_GRAYSCALE8);
+    f.integral.build(f.rgb, true);
+    String base = StringF("/corpus/%s_%dx%d", f.entry->pattern, f.entry->width, f.entry->height);
+    f.jpegPath = base + ".jpg";
+    f.bmpPath = base + ".bmp";
+    f.jpeg.metadata["pattern"] = f.entry->pattern;
+    f.jpeg.metadata["size"] = StringF("%dx%d", f.entry->width, f.entry->height);
+    f.jpeg.toFile(*f.fs, f.jpegPath).save();
+    // A sidecar of a typical size, with some values that need escaping
+    for (int i = 0; i < 32; i++) {
+        f.metadata[StringF("label %02d", i)] = i % 4 ? StringF("value %d of %s", i, f.entry->pattern) : String("C:\\images\\\"quoted\"\tand tabbed");
+    }
+    metadata_json::write(f.metadata, f.metadataJson);
+    f.bmp.toFile(*f.fs, f.bmpPath).save();
+}
+
+static std::vector<BenchCase> benchCases() {
+    std::vector<BenchCase> cases;
+    cases.push_back({ "load/buffer-rgb565", [](Fixture& f) {
+        Image image;
+        loadRgb(image, f.rgb565, *f.entry);
+    }});
+    cases.push_back({ "load/camera-jpeg", [](Fixture& f) {
+        camera_fb_t fb = { f.jpeg.buffer, f.jpeg.len, f.jpeg.width, f.jpeg.height, PIXFORMAT_JPEG, { 0, 0 } };
+        Image image;
+        image.fromCamera(&fb).load();
+    }});
+    cases.push_back({ "view/camera-jpeg", [](Fixture& f) {
+        camera_fb_t fb = { f.jpeg.buffer, f.jpeg.len, f.jpeg.width, f.jpeg.height, PIXFORMAT_JPEG, { 0, 0 } };
+        Image image;
+        image.fromCamera(&fb).view();
+    }});
+    cases.push_back({ "view/buffer-rgb565", [](Fixture& f) {
+        Image image;
+        image.fromBuffer(f.rgb565.data(), f.entry->width, f.entry->height, f.rgb565.size(), IMAGE_RGB565).view();
+    }});
+    cases.push_back({ "load/file-jpeg", [](Fixture& f) {
+        Image image;
+        image.fromFile(*f.fs, f.jpegPath).load();
+    }});
+    cases.push_back({ "probe/file-jpeg", [](Fixture& f) {
+        if (!Image::probe(*f.fs, f.jpegPath).valid) throw RuntimeError("probe failed");
+    }});
+    cases.push_back({ "load/file-bmp", [](Fixture& f) {
+        Image image;
+        image.fromFile(*f.fs, f.bmpPath).load();
+    }});
+    cases.push_back({ "history/copy", [](Fixture& f) {
+        f.history.fromImage(f.rgb).load();
+    }});
+    cases.push_back({ "history/swap", [](Fixture& f) {
+        f.history.swap(f.rgbNext);
+        f.history.swap(f.rgbNext);
+    }});
+    cases.push_back({ "convert/jpeg-rgb565", [](Fixture& f) {
+        Image image;
+        image.fromImage(f.jpeg).convertTo(IMAGE_RGB565);
+    }});
+    cases.push_back({ "convert/file-jpeg-rgb565", [](Fixture& f) {
+        Image image;
+        image.fromFile(*f.fs, f.jpegPath).convertTo(IMAGE_RGB565);
+    }});
+    cases.push_back({ "convert/file-jpeg-rgb565-div4", [](Fixture& f) {
+        Image image;
+        image.fromFile(*f.fs, f.jpegPath).convertTo(IMAGE_RGB565, SCALING_DIVIDE_4);
+    }});
+    cases.push_back({ "convert/jpeg-rgb565-div4", [](Fixture& f) {
+        Image image;
+        image.fromImage(f.jpeg).convertTo(IMAGE_RGB565, SCALING_DIVIDE_4);
+    }});
+    cases.push_back({ "convert/jpeg-rgb565-reuse", [](Fixture& f) {
+        f.frame.fromImage(f.jpeg).convertTo(IMAGE_RGB565);
+    }});
+    cases.push_back({ "convert/jpeg-rgb565-pooled", [](Fixture& f) {
+        ImageBufferPool::instance().enable(64 << 20);
+        Image image;
+        image.fromImage(f.jpeg).convertTo(IMAGE_RGB565);
+    }});
+    cases.push_back({ "convert/jpeg-grey", [](Fixture& f) {
+        Image image;
+        image.fromImage(f.jpeg).convertTo(IMAGE_GRAYSCALE8);
+    }});
+    cases.push_back({ "convert/jpeg-rgb565-top-band", [](Fixture& f) {
+        f.frame.fromImage(f.jpeg).region(0, 0, f.entry->width, f.entry->height / 4).convertTo(IMAGE_RGB565);
+    }});
+    cases.push_back({ "convert/jpeg-rgb565-centre", [](Fixture& f) {
+        int w = f.entry->width / 4, h = f.entry->height / 4;
+        f.frame.fromImage(f.jpeg).region(w, h, 2 * w, 2 * h).convertTo(IMAGE_RGB565);
+    }});
+    cases.push_back({ "crop/rgb565-centre", [](Fixture& f) {
+        int w = f.entry->width / 4, h = f.entry->height / 4;
+        f.frame.fromImage(f.rgb).crop(w, h, 2 * w, 2 * h);
+    }});
+    cases.push_back({ "convert/rgb565-bmp", [](Fixture& f) {
+        Image image;
+        image.fromImage(f.rgb).convertTo(IMAGE_BMP);
+    }});
+    cases.push_back({ "convert/pixel-order-swap", [](Fixture& f) {
+        f.rgbNative.setPixelOrder(PIXEL_ORDER_CAMERA);
+        f.rgbNative.setPixelOrder(PIXEL_ORDER_NATIVE);
+    }});
+    cases.push_back({ "convert/jpeg-rgb565-native", [](Fixture& f) {
+        Image image;
+        image.setPixelOrder(PIXEL_ORDER_NATIVE);
+        image.fromImage(f.jpeg).convertTo(IMAGE_RGB565);
+    }});
+    cases.push_back({ "convert/rgb565-rgb888", [](Fixture& f) {
+        f.frame.fromImage(f.rgb).convertTo(IMAGE_RGB888);
+    }});
+    cases.push_back({ "convert/rgb888-rgb565", [](Fixture& f) {
+        f.frame.fromImage(f.rgb888).convertTo(IMAGE_RGB565);
+    }});
+    cases.push_back({ "convert/rgb565-grey", [](Fixture& f) {
+        f.frame.fromImage(f.rgb).convertTo(IMAGE_GRAYSCALE8);
+    }});
+    cases.push_back({ "convert/rgb888-grey", [](Fixture& f) {
+        f.frame.fromImage(f.rgb888).convertTo(IMAGE_GRAYSCALE8);
+    }});
+    cases.push_back({ "convert/grey-rgb565", [](Fixture& f) {
+        f.frame.fromImage(f.grey).convertTo(IMAGE_RGB565);
+    }});
+    cases.push_back({ "convert/bmp-rgb565", [](Fixture& f) {
+        f.frame.fromImage(f.bmp).convertTo(IMAGE_RGB565);
+    }});
+    cases.push_back({ "convert/bmp-rgb888", [](Fixture& f) {
+        f.frame.fromImage(f.bmp).convertTo(IMAGE_RGB888);
+    }});
+    cases.push_back({ "convert/jpeg-bmp", [](Fixture& f) {
+        f.frame.fromImage(f.jpeg).convertTo(IMAGE_BMP);
+    }});
+    cases.push_back({ "convert/rgb565-jpeg", [](Fixture& f) {
+        Image image;
+        image.fromImage(f.rgb).convertTo(IMAGE_JPEG);
+    }});
+    cases.push_back({ "convert/rgb565-jpeg-q80", [](Fixture& f) {
+        Image image;
+        image.fromImage(f.rgb).convertTo(IMAGE_JPEG, 80);
+    }});
+    cases.push_back({ "convert/rgb565-jpeg-target", [](Fixture& f) {
+        // Bisects down to about the default quality
+        Image image;
+        image.fromImage(f.rgb).convertTo(IMAGE_JPEG, f.jpeg.len, 1);
+    }});
+    cases.push_back({ "convert/rgb565-jpeg-pooled", [](Fixture& f) {
+        ImageBufferPool::instance().enable(64 << 20);
+        Image image;
+        image.fromImage(f.rgb).convertTo(IMAGE_JPEG);
+    }});
+    cases.push_back({ "resize/rgb565-96x96-nearest", [](Fixture& f) {
+        f.frame.fromImage(f.rgb).resize(96, 96, RESIZE_NEAREST);
+    }});
+    cases.push_back({ "resize/rgb565-96x96-bilinear", [](Fixture& f) {
+        f.frame.fromImage(f.rgb).resize(96, 96, RESIZE_BILINEAR);
+    }});
+    cases.push_back({ "resize/rgb565-96x96-area", [](Fixture& f) {
+        f.frame.fromImage(f.rgb).resize(96, 96, RESIZE_AREA);
+    }});
+    cases.push_back({ "resize/grey-96x96-area", [](Fixture& f) {
+        f.frame.fromImage(f.grey).resize(96, 96, RESIZE_AREA);
+    }});
+    cases.push_back({ "resize/grey-2x-bilinear", [](Fixture& f) {
+        f.frame.fromImage(f.grey).resize(2 * f.entry->width, 2 * f.entry->height, RESIZE_BILINEAR);
+    }});
+    cases.push_back({ "compare/lambda-grey", [](Fixture& f) {
+        int threshold = 20;
+        benchSink += f.rgb.compareWith(f.rgbNext, 1, [threshold](int x, int y, Pixel thisPixel, Pixel prevPixel) {
+            return abs(thisPixel.grey() - prevPixel.grey()) > threshold;
+        }, noMask);
+    }});
+    cases.push_back({ "compare/lambda-grey-circle", [](Fixture& f) {
+        int threshold = 20;
+        benchSink += f.rgb.compareWith(f.rgbNext, 1, [threshold](int x, int y, Pixel thisPixel, Pixel prevPixel) {
+            return abs(thisPixel.grey() - prevPixel.grey()) > threshold;
+        }, insideCircle);
+    }});
+    cases.push_back({ "compare/function-grey", [](Fixture& f) {
+        int threshold = 20;
+        comparisonFunction compareFunc = [threshold](int x, int y, Pixel thisPixel, Pixel prevPixel) {
+            return abs(thisPixel.grey() - prevPixel.grey()) > threshold;
+        };
+        maskFunction maskFunc = noMask;
+        benchSink += f.rgb.compareWith(f.rgbNext, 1, compareFunc, maskFunc);
+    }});
+    cases.push_back({ "compare/grey-threshold", [](Fixture& f) {
+        benchSink += f.rgb.compareGreyThreshold(f.rgbNext, 20);
+    }});
+    cases.push_back({ "compare/grey-threshold-circle", [](Fixture& f) {
+        benchSink += f.rgb.compareGreyThreshold(f.rgbNext, 20, 1, insideCircle);
+    }});
+    // The same in row bands on the pool
+    cases.push_back({ "compare/lambda-grey-pool", [](Fixture& f) {
+        int threshold = 20;
+        f.rgb.setExecutor(&f.pool);
+        benchSink += f.rgb.compareWith(f.rgbNext, 1, [threshold](int x, int y, Pixel thisPixel, Pixel prevPixel) {
+            return abs(thisPixel.grey() - prevPixel.grey()) > threshold;
+        }, noMask);
+        f.rgb.setExecutor(nullptr);
+    }});
+    cases.push_back({ "compare/grey-threshold-pool", [](Fixture& f) {
+        f.rgb.setExecutor(&f.pool);
+        benchSink += f.rgb.compareGreyThreshold(f.rgbNext, 20);
+        f.rgb.setExecutor(nullptr);
+    }});
+    cases.push_back({ "compare/grey-threshold-circle-pool", [](Fixture& f) {
+        f.rgb.setExecutor(&f.pool);
+        benchSink += f.rgb.compareGreyThreshold(f.rgbNext, 20, 1, insideCircle);
+        f.rgb.setExecutor(nullptr);
+    }});
+    cases.push_back({ "compare/grey-threshold-native", [](Fixture& f) {
+        benchSink += f.rgbNative.compareGreyThreshold(f.rgbNextNative, 20);
+    }});
+    cases.push_back({ "compare/lambda-grey-native", [](Fixture& f) {
+        int threshold = 20;
+        benchSink += f.rgbNative.compareWith(f.rgbNextNative, 1, [threshold](int x, int y, Pixel thisPixel, Pixel prevPixel) {
+            return abs(thisPixel.grey() - prevPixel.grey()) > threshold;
+        });
+    }});
+    cases.push_back({ "compare/grey8-threshold", [](Fixture& f) {
+        benchSink += f.grey.compareGreyThreshold(f.greyNext, 20);
+    }});
+    cases.push_back({ "compare/decode-then-threshold", [](Fixture& f) {
+        Image image;
+        image.fromImage(f.jpeg).convertTo(IMAGE_RGB565);
+        benchSink += image.compareGreyThreshold(f.rgbNext, 20);
+    }});
+    cases.push_back({ "compare/jpeg-fused", [](Fixture& f) {
+        benchSink += f.jpeg.compareJpegWith(f.rgbNext, 20);
+    }});
+    cases.push_back({ "compare/jpeg-fused-mask", [](Fixture& f) {
+        benchSink += f.jpeg.compareJpegWith(f.rgbNext, 20, SCALING_NONE, f.circle);
+    }});
+    cases.push_back({ "compare/diffmap-16", [](Fixture& f) {
+        DiffMap diffMap(16, 16);
+        benchSink += f.rgb.compareGreyThreshold(f.rgbNext, 20, diffMap);
+        benchSink += diffMap.regions(0.1).size();
+    }});
+    cases.push_back({ "compare/diffmap-8-mask", [](Fixture& f) {
+        DiffMap diffMap(8, 8);
+        benchSink += f.rgb.compareGreyThreshold(f.rgbNext, 20, diffMap, f.circle);
+        benchSink += diffMap.regions(0.1).size();
+    }});
+    cases.push_back({ "compare/lambda-grey-mask", [](Fixture& f) {
+        int threshold = 20;
+        benchSink += f.rgb.compareWith(f.rgbNext, 1, [threshold](int x, int y, Pixel thisPixel, Pixel prevPixel) {
+            return abs(thisPixel.grey() - prevPixel.grey()) > threshold;
+        }, f.circle);
+    }});
+    cases.push_back({ "compare/grey-threshold-mask", [](Fixture& f) {
+        benchSink += f.rgb.compareGreyThreshold(f.rgbNext, 20, 1, f.circle);
+    }});
+    cases.push_back({ "mask/compile-circle", [](Fixture& f) {
+        Mask mask(f.entry->width, f.entry->height, insideCircle);
+        benchSink += mask.count();
+    }});
+    cases.push_back({ "stats/maxGrey", [](Fixture& f) {
+        benchSink += f.rgb.maxGrey();
+    }});
+    cases.push_back({ "stats/maxGrey-pool", [](Fixture& f) {
+        f.rgb.setExecutor(&f.pool);
+        benchSink += f.rgb.maxGrey();
+        f.rgb.setExecutor(nullptr);
+    }});
+    cases.push_back({ "stats/rgb565", [](Fixture& f) {
+        benchSink += f.rgb.stats().mean;
+    }});
+    cases.push_back({ "stats/rgb565-native", [](Fixture& f) {
+        benchSink += f.rgbNative.stats().mean;
+    }});
+    cases.push_back({ "stats/rgb565-channels", [](Fixture& f) {
+        benchSink += f.rgb.stats(nullptr, true).mean;
+    }});
+    cases.push_back({ "stats/rgb565-mask", [](Fixture& f) {
+        benchSink += f.rgb.stats(f.circle).mean;
+    }});
+    cases.push_back({ "stats/grey8", [](Fixture& f) {
+        benchSink += f.grey.stats().mean;
+    }});
+    cases.push_back({ "stats/bmp", [](Fixture& f) {
+        benchSink += f.bmp.stats().mean;
+    }});
+    cases.push_back({ "stats/maxGrey-mask", [](Fixture& f) {
+        benchSink += f.rgb.maxGrey(f.circle);
+    }});
+    cases.push_back({ "background/update", [](Fixture& f) {
+        static BackgroundModel model(0.05);
+        benchSink += model.update(f.rgb, 20);
+        benchSink += model.update(f.rgbNext, 20);
+    }});
+    cases.push_back({ "background/update-variance", [](Fixture& f) {
+        static BackgroundModel model(0.05, true);
+        benchSink += model.update(f.rgb, 20);
+        benchSink += model.update(f.rgbNext, 20);
+    }});
+    cases.push_back({ "background/update-grey-mask", [](Fixture& f) {
+        static BackgroundModel model(0.05);
+        benchSink += model.update(f.grey, 20, 1, f.circle);
+        benchSink += model.update(f.greyNext, 20, 1, f.circle);
+    }});
+    cases.push_back({ "integral/build", [](Fixture& f) {
+        f.integral.build(f.rgb);
+    }});
+    cases.push_back({ "integral/build-squares", [](Fixture& f) {
+        f.integral.build(f.rgb, true);
+    }});
+    cases.push_back({ "integral/zone-means-8x8", [](Fixture& f) {
+        // Mean and variance of every cell of an 8 x 8 grid
+        int w = f.entry->width / 8, h = f.entry->height / 8;
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+                benchSink += f.integral.mean(x * w, y * h, w, h) + f.integral.variance(x * w, y * h, w, h);
+            }
+        }
+    }});
+    cases.push_back({ "integral/box-filter-r4", [](Fixture& f) {
+        f.integral.boxFilter(f.filtered, 4);
+    }});
+    cases.push_back({ "metadata/write-32", [](Fixture& f) {
+        String json;
+        metadata_json::write(f.metadata, json);
+        benchSink += json.length();
+    }});
+    cases.push_back({ "metadata/parse-32", [](Fixture& f) {
+        std::map<String, String> metadata;
+        size_t errorAt;
+        if (!metadata_json::parse(f.metadataJson.c_str(), f.metadataJson.length(), metadata, errorAt)) {
+            throw RuntimeError(StringF("metadata JSON is bad at %d", (int)errorAt));
+        }
+        benchSink += metadata.size();
+    }});
+    cases.push_back({ "save/jpeg", [](Fixture& f) {
+        f.jpeg.toFile(*f.fs, "/out/bench.jpg").save();
+    }});
+    // A capture loop saving 8 frames, either itself or through the writer task. The copy stands in for the capture
+    cases.push_back({ "save/jpeg-x8", [](Fixture& f) {
+        for (int i = 0; i < 8; i++) {
+            Image image;
+            image.fromImage(f.jpeg).load();
+            image.toFile(*f.fs, StringF("/out/frame%d.jpg", i)).save();
+        }
+    }});
+    cases.push_back({ "writer/jpeg-x8", [](Fixture& f) {
+        for (int i = 0; i < 8; i++) {
+            Image image;
+            image.fromImage(f.jpeg).load();
+            f.writer.write(image, *f.fs, StringF("/out/queued%d.jpg", i));
+        }
+        f.writer.flush();
+        if (f.writer.stats().failed) throw RuntimeError("write failed");
+    }});
+    cases.push_back({ "save/bmp", [](Fixture& f) {
+        f.bmp.toFile(*f.fs, "/out/bench.bmp").save();
+    }});
+    cases.push_back({ "save/rgb565-bmp", [](Fixture& f) {
+        f.rgb.toFile(*f.fs, "/out/bench-rgb565.bmp").save();
+    }});
+    cases.push_back({ "save/grey-bmp", [](Fixture& f) {
+        f.grey.toFile(*f.fs, "/out/bench-grey.bmp").save();
+    }});
+    return cases;
+}
+
+// ---- Runner ----------------------------------------------------------------------------------
+
+struct Options {
+    String filter;
+    String size;
+    int minMs = 200;
+    bool csv = false;
+};
+
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--filter") && i + 1 < argc) options.filter = argv[++i];
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc) options.size = argv[++i];
+        else if (!strcmp(argv[i], "--min-ms") && i + 1 < argc) options.minMs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--csv")) options.csv = true;
+        else {
+            fprintf(stderr, "usage: %s [--filter <substring>] [--size <WxH>] [--min-ms <n>] [--csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    char rootDir[] = "/tmp/esp_image_bench.XXXXXX";
+    if (!mkdtemp(rootDir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    FS fs(rootDir);
+
+    if (options.csv) {
+        printf("case,image,ns_per_pixel,bytes_per_op,allocs_per_op,peak_bytes,us_per_op\n");
+    } else {
+        printf("%-32s %-18s %12s %14s %10s %14s %12s\n", "case", "image", "ns/pixel", "bytes/op", "allocs/op", "peak bytes", "us/op");
+    }
+    std::vector<BenchCase> cases = benchCases();
+    int failures = 0;
+    for (const CorpusEntry& entry : corpus) {
+        String imageName = StringF("%s %dx%d", entry.pattern, entry.width, entry.height);
+        if (options.size.length() && options.size != StringF("%dx%d", entry.width, entry.height)) continue;
+        Fixture f;
+        f.entry = &entry;
+        f.fs = &fs;
+        prepareFixture(f);
+        size_t pixels = (size_t)entry.width * entry.height;
+        for (const BenchCase& c : cases) {
+            if (options.filter.length() && String(c.name).indexOf(options.filter) < 0) continue;
+            try {
+                c.run(f); // warm up
+                size_t bytesBefore = allocatedBytes, countBefore = allocationCount;
+                size_t liveBefore = liveBytes;
+                peakLiveBytes = liveBefore;
+                long iterations = 0;
+                auto start = std::chrono::steady_clock::now();
+                auto elapsed = std::chrono::steady_clock::duration::zero();
+                do {
+                    c.run(f);
+                    iterations++;
+                    elapsed = std::chrono::steady_clock::now() - start;
+                } while (elapsed < std::chrono::milliseconds(options.minMs) || iterations < 3);
+                double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+                double nsPerPixel = ns / iterations / pixels;
+                double usPerOp = ns / iterations / 1000;
+                double bytesPerOp = (double)(allocatedBytes - bytesBefore) / iterations;
+                double allocsPerOp = (double)(allocationCount - countBefore) / iterations;
+                size_t peak = peakLiveBytes - liveBefore;
+                if (options.csv) {
+                    printf("%s,%s,%.3f,%.0f,%.1f,%zu,%.3f\n", c.name, imageName.c_str(), nsPerPixel, bytesPerOp, allocsPerOp, peak, usPerOp);
+                } else {
+                    printf("%-32s %-18s %12.3f %14.0f %10.1f %14zu %12.3f\n", c.name, imageName.c_str(), nsPerPixel, bytesPerOp, allocsPerOp, peak, usPerOp);
+                }
+            } catch (std::exception const& ex) {
+                printf("%-32s %-18s FAILED: %s\n", c.name, imageName.c_str(), ex.what());
+                failures++;
+            }
+            // Cases that use the pool enable it for themselves
+            ImageBufferPool::instance().disable();
+            fflush(stdout);
+        }
+    }
+    nftw(rootDir, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    return failures ? 2 : 0;
+}
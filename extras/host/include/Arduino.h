@@ -0,0 +1,69 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+/*
+** Host stand-in for the parts of the Arduino core used by ESP-Image
+** Logging follows the arduino-esp32 convention: log_x() compiles away unless
+** CORE_DEBUG_LEVEL is at least the level of the message (1=error ... 5=verbose)
+*/
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <sys/time.h>
+#include "WString.h"
+#include "StringF.h"
+
+#ifndef CORE_DEBUG_LEVEL
+#define CORE_DEBUG_LEVEL 0
+#endif
+
+#define PROGMEM
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+// Let String arguments be passed straight to printf-style formats as they are on the ESP32
+inline const char* hostLogArg(const String& s) { return s.c_str(); }
+template<typename T> inline T hostLogArg(T value) { return value; }
+
+template<typename... Args>
+inline void hostLog(char level, const char* file, int line, const char* format, Args... args) {
+    fprintf(stderr, "[%c][%s:%d] ", level, file, line);
+    fprintf(stderr, format, hostLogArg(args)...);
+    fprintf(stderr, "\n");
+}
+inline void hostLog(char level, const char* file, int line, const char* format) {
+    fprintf(stderr, "[%c][%s:%d] %s\n", level, file, line, format);
+}
+
+#if CORE_DEBUG_LEVEL >= 1
+#define log_e(format, ...) hostLog('E', __FILE__, __LINE__, format, ##__VA_ARGS__)
+#else
+#define log_e(format, ...) do {} while (0)
+#endif
+#if CORE_DEBUG_LEVEL >= 2
+#define log_w(format, ...) hostLog('W', __FILE__, __LINE__, format, ##__VA_ARGS__)
+#else
+#define log_w(format, ...) do {} while (0)
+#endif
+#if CORE_DEBUG_LEVEL >= 3
+#define log_i(format, ...) hostLog('I', __FILE__, __LINE__, format, ##__VA_ARGS__)
+#else
+#define log_i(format, ...) do {} while (0)
+#endif
+#if CORE_DEBUG_LEVEL >= 4
+#define log_d(format, ...) hostLog('D', __FILE__, __LINE__, format, ##__VA_ARGS__)
+#else
+#define log_d(format, ...) do {} while (0)
+#endif
+#if CORE_DEBUG_LEVEL >= 5
+#define log_v(format, ...) hostLog('V', __FILE__, __LINE__, format, ##__VA_ARGS__)
+#else
+#define log_v(format, ...) do {} while (0)
+#endif
+
+#endif
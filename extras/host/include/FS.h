@@ -0,0 +1,75 @@
+#ifndef HOST_FS_H
+#define HOST_FS_H
+/*
+** Host stand-in for the arduino-esp32 FS/File API
+** An FS is rooted at a local directory so that "/abc.jpg" maps to "<root>/abc.jpg"
+*/
+#include <memory>
+#include <ctime>
+#include "Arduino.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+class File {
+    public:
+        File() {}
+        File(FILE* fp, const String& path, const String& hostPath);
+        size_t write(uint8_t c) { return write(&c, 1); }
+        size_t write(const uint8_t* buf, size_t size);
+        int available();
+        int read();
+        size_t read(uint8_t* buf, size_t size);
+        size_t readBytes(char* buf, size_t size) { return read((uint8_t*)buf, size); }
+        int peek();
+        void flush();
+        bool seek(uint32_t pos, SeekMode mode = SeekSet);
+        size_t position() const;
+        size_t size() const;
+        void close();
+        time_t getLastWrite();
+        const char* path() const { return _path.c_str(); }
+        operator bool() const { return _fp != nullptr && *_fp != nullptr; }
+    private:
+        std::shared_ptr<FILE*> _fp;
+        String _path;
+        String _hostPath;
+};
+
+class FS {
+    public:
+        FS(const String& rootDir) : _root(rootDir) {}
+        File open(const char* path, const char* mode = FILE_READ, const bool create = false);
+        File open(const String& path, const char* mode = FILE_READ, const bool create = false) { return open(path.c_str(), mode, create); }
+        bool exists(const char* path);
+        bool exists(const String& path) { return exists(path.c_str()); }
+        bool remove(const char* path);
+        bool remove(const String& path) { return remove(path.c_str()); }
+        bool mkdir(const char* path);
+        bool mkdir(const String& path) { return mkdir(path.c_str()); }
+        bool rmdir(const char* path);
+        bool rmdir(const String& path) { return rmdir(path.c_str()); }
+        String hostPath(const char* path) const;
+    private:
+        String _root;
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef HOST_STRINGF_H
+#define HOST_STRINGF_H
+/*
+** Host stand-in for StringF(): printf-style formatting into a String
+** String arguments are passed through as their c_str()
+*/
+#include <cstdio>
+#include <vector>
+#include "WString.h"
+
+inline const char* stringFArg(const String& s) { return s.c_str(); }
+template<typename T> inline T stringFArg(T value) { return value; }
+
+template<typename... Args>
+String StringF(const char* format, Args... args) {
+    int len = snprintf(nullptr, 0, format, stringFArg(args)...);
+    if (len <= 0) return String();
+    std::vector<char> buf(len + 1);
+    snprintf(buf.data(), buf.size(), format, stringFArg(args)...);
+    return String(buf.data());
+}
+inline String StringF(const char* format) { return String(format); }
+#endif
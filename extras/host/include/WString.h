@@ -0,0 +1,87 @@
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+/*
+** Host stand-in for the Arduino String class
+** Only the parts of the API used by ESP-Image are provided, backed by std::string
+*/
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+class String {
+    public:
+        String() {}
+        String(const char* s) : _s(s ? s : "") {}
+        String(const std::string& s) : _s(s) {}
+        String(char c) : _s(1, c) {}
+        String(int value) : _s(std::to_string(value)) {}
+        String(unsigned int value) : _s(std::to_string(value)) {}
+        String(long value) : _s(std::to_string(value)) {}
+        String(unsigned long value) : _s(std::to_string(value)) {}
+
+        const char* c_str() const { return _s.c_str(); }
+        unsigned int length() const { return _s.length(); }
+        bool reserve(unsigned int size) { _s.reserve(size); return true; }
+        char charAt(unsigned int index) const { return index < _s.length() ? _s[index] : 0; }
+        char operator[](unsigned int index) const { return charAt(index); }
+        long toInt() const { return strtol(_s.c_str(), nullptr, 10); }
+        float toFloat() const { return strtof(_s.c_str(), nullptr); }
+
+        String& operator+=(const String& rhs) { _s += rhs._s; return *this; }
+        String& operator+=(const char* rhs) { if (rhs) _s += rhs; return *this; }
+        String& operator+=(char c) { _s += c; return *this; }
+        String& operator+=(int value) { _s += std::to_string(value); return *this; }
+        bool concat(const char* s, unsigned int len) { _s.append(s, len); return true; }
+        bool concat(const String& s) { _s += s._s; return true; }
+        bool concat(char c) { _s += c; return true; }
+
+        friend String operator+(const String& lhs, const String& rhs) { return String(lhs._s + rhs._s); }
+        friend String operator+(const String& lhs, const char* rhs) { return String(lhs._s + (rhs ? rhs : "")); }
+        friend String operator+(const char* lhs, const String& rhs) { return String(std::string(lhs ? lhs : "") + rhs._s); }
+        friend String operator+(const String& lhs, char c) { return String(lhs._s + c); }
+
+        bool operator==(const String& rhs) const { return _s == rhs._s; }
+        bool operator==(const char* rhs) const { return _s == (rhs ? rhs : ""); }
+        bool operator!=(const String& rhs) const { return _s != rhs._s; }
+        bool operator!=(const char* rhs) const { return _s != (rhs ? rhs : ""); }
+        bool operator<(const String& rhs) const { return _s < rhs._s; }
+        bool equals(const String& rhs) const { return _s == rhs._s; }
+
+        int indexOf(char c) const { return indexOf(c, 0); }
+        int indexOf(char c, unsigned int from) const { return toIndex(_s.find(c, from)); }
+        int indexOf(const String& s) const { return indexOf(s, 0); }
+        int indexOf(const String& s, unsigned int from) const { return toIndex(_s.find(s._s, from)); }
+        int lastIndexOf(char c) const { return toIndex(_s.rfind(c)); }
+        bool startsWith(const String& prefix) const { return _s.compare(0, prefix._s.length(), prefix._s) == 0; }
+        bool endsWith(const String& suffix) const {
+            return _s.length() >= suffix._s.length() && _s.compare(_s.length() - suffix._s.length(), suffix._s.length(), suffix._s) == 0;
+        }
+        String substring(unsigned int from) const { return from < _s.length() ? String(_s.substr(from)) : String(); }
+        String substring(unsigned int from, unsigned int to) const {
+            if (from > to) std::swap(from, to);
+            if (from >= _s.length()) return String();
+            return String(_s.substr(from, to - from));
+        }
+        void replace(const String& find, const String& with) {
+            if (find._s.empty()) return;
+            size_t pos = 0;
+            while ((pos = _s.find(find._s, pos)) != std::string::npos) {
+                _s.replace(pos, find._s.length(), with._s);
+                pos += with._s.length();
+            }
+        }
+        void toLowerCase() { for (auto& c : _s) c = tolower((unsigned char)c); }
+        void toUpperCase() { for (auto& c : _s) c = toupper((unsigned char)c); }
+        void trim() {
+            size_t start = 0;
+            while (start < _s.length() && isspace((unsigned char)_s[start])) start++;
+            size_t end = _s.length();
+            while (end > start && isspace((unsigned char)_s[end - 1])) end--;
+            _s = _s.substr(start, end - start);
+        }
+    private:
+        static int toIndex(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+        std::string _s;
+};
+#endif
@@ -0,0 +1,27 @@
+#ifndef HOST_ESP_JPG_DECODE_H
+#define HOST_ESP_JPG_DECODE_H
+/*
+** Host stand-in for esp32-camera's esp_jpg_decode()
+** The callback protocol matches the real decoder: the writer is called once with data == NULL
+** at (0, 0) to announce the output size, once per decoded block with RGB888 data, and once
+** with data == NULL at (width, height) at the end. A writer returning false aborts the decode.
+** The data itself is the stand-in codec produced by fmt2jpg() - see img_converters.cpp
+*/
+#include <cstdint>
+#include <cstddef>
+#include "esp_camera.h"
+
+typedef enum {
+    JPG_SCALE_NONE,
+    JPG_SCALE_2X,
+    JPG_SCALE_4X,
+    JPG_SCALE_8X,
+    JPG_SCALE_MAX = JPG_SCALE_8X
+} jpg_scale_t;
+
+typedef unsigned int (*jpg_reader_cb)(void* arg, size_t index, uint8_t* buf, size_t len);
+typedef bool (*jpg_writer_cb)(void* arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t* data);
+
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void* arg);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HOST_IMG_CONVERTERS_H
+#define HOST_IMG_CONVERTERS_H
+/*
+** Host stand-in for esp32-camera's img_converters.h
+** Output buffers are allocated with new[] because ESP-Image releases them with delete[]
+*/
+#include <cstdint>
+#include <cstddef>
+#include "esp_camera.h"
+#include "esp_jpg_decode.h"
+
+typedef size_t (*jpg_out_cb)(void* arg, size_t index, const void* data, size_t len);
+
+bool fmt2jpg_cb(uint8_t* src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void* arg);
+bool fmt2jpg(uint8_t* src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t** out, size_t* out_len);
+bool fmt2bmp(uint8_t* src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t** out, size_t* out_len);
+
+#endif
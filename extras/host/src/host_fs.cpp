@@ -0,0 +1,110 @@
+/*
+** Host stand-in for the arduino-esp32 FS/File API backed by stdio
+*/
+#include <sys/stat.h>
+#include <unistd.h>
+#include "FS.h"
+
+namespace fs {
+
+File::File(FILE* fp, const String& path, const String& hostPath) :
+    _fp(new FILE*(fp), [](FILE** p) { if (*p) fclose(*p); delete p; }),
+    _path(path),
+    _hostPath(hostPath) {
+}
+
+size_t File::write(const uint8_t* buf, size_t size) {
+    if (!*this) return 0;
+    return fwrite(buf, 1, size, *_fp);
+}
+
+int File::available() {
+    if (!*this) return 0;
+    long remaining = (long)size() - (long)position();
+    return remaining > 0 ? remaining : 0;
+}
+
+int File::read() {
+    if (!*this) return -1;
+    return fgetc(*_fp);
+}
+
+size_t File::read(uint8_t* buf, size_t size) {
+    if (!*this) return 0;
+    return fread(buf, 1, size, *_fp);
+}
+
+int File::peek() {
+    if (!*this) return -1;
+    int c = fgetc(*_fp);
+    if (c != EOF) ungetc(c, *_fp);
+    return c;
+}
+
+void File::flush() {
+    if (*this) fflush(*_fp);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+    if (!*this) return false;
+    int whence = mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END;
+    return fseek(*_fp, pos, whence) == 0;
+}
+
+size_t File::position() const {
+    if (!*this) return 0;
+    return ftell(*_fp);
+}
+
+size_t File::size() const {
+    if (!*this) return 0;
+    struct stat st;
+    if (fstat(fileno(*_fp), &st) != 0) return 0;
+    return st.st_size;
+}
+
+void File::close() {
+    if (*this) {
+        fclose(*_fp);
+        *_fp = nullptr;
+    }
+}
+
+time_t File::getLastWrite() {
+    struct stat st;
+    if (stat(_hostPath.c_str(), &st) != 0) return 0;
+    return st.st_mtime;
+}
+
+String FS::hostPath(const char* path) const {
+    String ret = _root;
+    if (path[0] != '/') ret += "/";
+    ret += path;
+    return ret;
+}
+
+File FS::open(const char* path, const char* mode, const bool create) {
+    String host = hostPath(path);
+    FILE* fp = fopen(host.c_str(), mode[0] == 'r' ? "rb" : mode[0] == 'a' ? "ab" : "wb");
+    if (!fp) return File();
+    return File(fp, path, host);
+}
+
+bool FS::exists(const char* path) {
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char* path) {
+    return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::mkdir(const char* path) {
+    return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::rmdir(const char* path) {
+    return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+} // namespace fs
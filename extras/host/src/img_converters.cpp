@@ -0,0 +1,395 @@
+/*
+** Host stand-ins for the esp32-camera image converters
+**
+** fmt2jpg() does not produce a real JPEG. It writes a JPEG-shaped container (SOI, DQT, SOF0, SOS,
+** payload, EOI) so that segment parsing, sizes and callbacks in ESP-Image behave as they do on the
+** ESP32, but the entropy-coded data is replaced by a quality-dependent quantised run-length code.
+** esp_jpg_decode() understands only that payload. Timings of the codec itself are therefore not
+** representative; everything ESP-Image does around it is.
+*/
+#include <cstring>
+#include <vector>
+#include "img_converters.h"
+
+static const uint8_t stdLuminanceQuant[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+};
+
+static int quantStep(int quality) {
+    return 1 + (100 - quality) / 8;
+}
+
+// Buffered output through the jpg_out_cb. Like callback_stream in esp32-camera it ignores what the callback
+// returns and carries on encoding, so a short write does not fail fmt2jpg_cb()
+class JpegOut {
+    public:
+        JpegOut(jpg_out_cb cb, void* arg) : _cb(cb), _arg(arg), _index(0), _used(0) {}
+        void put(uint8_t c) {
+            if (_used == sizeof(_buf)) flush();
+            _buf[_used++] = c;
+        }
+        void word(uint16_t w) { put(w >> 8); put(w & 0xFF); }
+        bool flush() {
+            if (_used) {
+                _cb(_arg, _index, _buf, _used);
+                _index += _used;
+            }
+            _used = 0;
+            return true;
+        }
+    private:
+        jpg_out_cb _cb;
+        void* _arg;
+        size_t _index;
+        size_t _used;
+        uint8_t _buf[1024];
+};
+
+bool fmt2jpg_cb(uint8_t* src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void* arg) {
+    size_t bpp;
+    switch (format) {
+        case PIXFORMAT_RGB565: bpp = 2; break;
+        case PIXFORMAT_RGB888: bpp = 3; break;
+        case PIXFORMAT_GRAYSCALE: bpp = 1; break;
+        default: return false;
+    }
+    if (!src || width == 0 || height == 0 || src_len < (size_t)width * height * bpp) return false;
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
+    int channels = format == PIXFORMAT_GRAYSCALE ? 1 : 3;
+    int step = quantStep(quality);
+
+    JpegOut out(cb, arg);
+    out.word(0xFFD8);
+    // DQT scaled the way libjpeg does so quality can be estimated from it
+    int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+    out.word(0xFFDB);
+    out.word(67);
+    out.put(0);
+    for (int i = 0; i < 64; i++) {
+        int q = (stdLuminanceQuant[i] * scale + 50) / 100;
+        out.put(q < 1 ? 1 : q > 255 ? 255 : q);
+    }
+    // SOF0
+    out.word(0xFFC0);
+    out.word(8 + 3 * channels);
+    out.put(8);
+    out.word(height);
+    out.word(width);
+    out.put(channels);
+    for (int c = 0; c < channels; c++) {
+        out.put(c + 1);
+        out.put(c == 0 && channels == 3 ? 0x22 : 0x11);
+        out.put(c == 0 ? 0 : 1);
+    }
+    // SOS
+    out.word(0xFFDA);
+    out.word(6 + 2 * channels);
+    out.put(channels);
+    for (int c = 0; c < channels; c++) {
+        out.put(c + 1);
+        out.put(c == 0 ? 0x00 : 0x11);
+    }
+    out.put(0);
+    out.put(63);
+    out.put(0);
+    // Stand-in payload: quant step then runs of (count - 1, quantised channels...)
+    out.put(step);
+    size_t pixels = (size_t)width * height;
+    uint8_t prev[3] = { 0, 0, 0 };
+    int run = 0;
+    for (size_t i = 0; i < pixels; i++) {
+        uint8_t px[3];
+        if (format == PIXFORMAT_RGB565) {
+            // Big-endian in memory as delivered by the camera driver
+            uint8_t hb = src[2 * i];
+            uint8_t lb = src[2 * i + 1];
+            px[0] = hb & 0xF8;
+            px[1] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+            px[2] = (lb & 0x1F) << 3;
+        } else if (format == PIXFORMAT_RGB888) {
+            // Stored as B G R in memory
+            px[0] = src[3 * i + 2];
+            px[1] = src[3 * i + 1];
+            px[2] = src[3 * i];
+        } else {
+            px[0] = src[i];
+        }
+        for (int c = 0; c < channels; c++) px[c] /= step;
+        if (run > 0 && run < 256 && memcmp(px, prev, channels) == 0) {
+            run++;
+            continue;
+        }
+        if (run > 0) {
+            out.put(run - 1);
+            for (int c = 0; c < channels; c++) out.put(prev[c]);
+        }
+        memcpy(prev, px, channels);
+        run = 1;
+    }
+    out.put(run - 1);
+    for (int c = 0; c < channels; c++) out.put(prev[c]);
+    out.word(0xFFD9);
+    return out.flush();
+}
+
+typedef struct {
+    uint8_t* buf;
+    size_t len;
+    size_t capacity;
+} jpg_mem_out_t;
+
+static size_t _mem_out(void* arg, size_t index, const void* data, size_t len) {
+    jpg_mem_out_t* mem = (jpg_mem_out_t*)arg;
+    if (index + len > mem->capacity) {
+        size_t capacity = mem->capacity ? mem->capacity : 16 * 1024;
+        while (capacity < index + len) capacity *= 2;
+        uint8_t* grown = new uint8_t[capacity];
+        if (mem->buf) {
+            memcpy(grown, mem->buf, mem->len);
+            delete[] mem->buf;
+        }
+        mem->buf = grown;
+        mem->capacity = capacity;
+    }
+    memcpy(mem->buf + index, data, len);
+    mem->len = index + len;
+    return len;
+}
+
+bool fmt2jpg(uint8_t* src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t** out, size_t* out_len) {
+    jpg_mem_out_t mem = { nullptr, 0, 0 };
+    if (!fmt2jpg_cb(src, src_len, width, height, format, quality, _mem_out, &mem)) {
+        delete[] mem.buf;
+        return false;
+    }
+    *out = mem.buf;
+    *out_len = mem.len;
+    return true;
+}
+
+// Sequential reader over the jpg_reader_cb, mirroring the small input window of tjpgd
+class JpegIn {
+    public:
+        JpegIn(jpg_reader_cb reader, void* arg, size_t len) : _reader(reader), _arg(arg), _len(len), _index(0), _pos(0), _used(0) {}
+        int get() {
+            if (_pos == _used) {
+                size_t want = _len - _index < sizeof(_buf) ? _len - _index : sizeof(_buf);
+                if (want == 0) return -1;
+                _used = _reader(_arg, _index, _buf, want);
+                _index += _used;
+                _pos = 0;
+                if (_used == 0) return -1;
+            }
+            return _buf[_pos++];
+        }
+        int word() {
+            int h = get();
+            int l = get();
+            return (h < 0 || l < 0) ? -1 : (h << 8 | l);
+        }
+        bool skip(size_t n) {
+            size_t buffered = _used - _pos;
+            if (n <= buffered) {
+                _pos += n;
+                return true;
+            }
+            n -= buffered;
+            _pos = _used;
+            if (_index + n > _len) return false;
+            _reader(_arg, _index, nullptr, n);
+            _index += n;
+            return true;
+        }
+    private:
+        jpg_reader_cb _reader;
+        void* _arg;
+        size_t _len;
+        size_t _index;
+        size_t _pos;
+        size_t _used;
+        uint8_t _buf[512];
+};
+
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void* arg) {
+    if (scale > JPG_SCALE_MAX) return ESP_FAIL;
+    JpegIn in(reader, arg, len);
+    if (in.word() != 0xFFD8) return ESP_FAIL;
+    int width = 0, height = 0, channels = 0;
+    for (;;) {
+        int marker = in.word();
+        if (marker < 0 || (marker & 0xFF00) != 0xFF00) return ESP_FAIL;
+        int segLen = in.word();
+        if (segLen < 2) return ESP_FAIL;
+        if (marker == 0xFFC0 || marker == 0xFFC1 || marker == 0xFFC2) {
+            in.get();
+            height = in.word();
+            width = in.word();
+            channels = in.get();
+            if (!in.skip(segLen - 8)) return ESP_FAIL;
+        } else if (marker == 0xFFDA) {
+            if (!in.skip(segLen - 2)) return ESP_FAIL;
+            break;
+        } else {
+            if (!in.skip(segLen - 2)) return ESP_FAIL;
+        }
+    }
+    if (width <= 0 || height <= 0 || (channels != 1 && channels != 3)) return ESP_FAIL;
+    int step = in.get();
+    if (step <= 0) return ESP_FAIL;
+
+    uint16_t outW = width >> scale;
+    uint16_t outH = height >> scale;
+    if (outW == 0 || outH == 0) return ESP_FAIL;
+    // esp32-camera ignores what the start call returns, so writers must cope with the decode going on regardless
+    writer(arg, 0, 0, outW, outH, nullptr);
+
+    // Like jd_decomp(), stops at corrupt data or when the writer returns false
+    auto decompress = [&]() -> bool {
+        int mcu = channels == 3 ? 16 : 8;
+        int bandRows = mcu > (1 << scale) ? mcu : (1 << scale);
+        int outBlock = bandRows >> scale;
+        std::vector<uint8_t> band((size_t)bandRows * width * 3);
+        std::vector<uint8_t> block((size_t)outBlock * outBlock * 3);
+        int run = 0;
+        uint8_t px[3] = { 0, 0, 0 };
+        for (int bandY = 0; bandY < height; bandY += bandRows) {
+            int rows = height - bandY < bandRows ? height - bandY : bandRows;
+            uint8_t* o = band.data();
+            for (size_t i = 0; i < (size_t)rows * width; i++) {
+                if (run == 0) {
+                    int count = in.get();
+                    if (count < 0) return false;
+                    run = count + 1;
+                    for (int c = 0; c < channels; c++) {
+                        int q = in.get();
+                        if (q < 0) return false;
+                        int v = q * step + step / 2;
+                        px[c] = v > 255 ? 255 : v;
+                    }
+                    if (channels == 1) px[1] = px[2] = px[0];
+                }
+                run--;
+                *o++ = px[0];
+                *o++ = px[1];
+                *o++ = px[2];
+            }
+            int outY = bandY >> scale;
+            if (outY >= outH) break;
+            int h = outH - outY < outBlock ? outH - outY : outBlock;
+            for (int outX = 0; outX < outW; outX += outBlock) {
+                int w = outW - outX < outBlock ? outW - outX : outBlock;
+                uint8_t* b = block.data();
+                for (int iy = 0; iy < h; iy++) {
+                    const uint8_t* row = band.data() + ((size_t)(iy << scale) * width) * 3;
+                    for (int ix = 0; ix < w; ix++) {
+                        const uint8_t* p = row + (size_t)((outX + ix) << scale) * 3;
+                        *b++ = p[0];
+                        *b++ = p[1];
+                        *b++ = p[2];
+                    }
+                }
+                if (!writer(arg, outX, outY, w, h, block.data())) return false;
+            }
+        }
+        return true;
+    };
+    bool decoded = decompress();
+    // esp32-camera makes the end call whether or not the decode got through
+    writer(arg, outW, outH, outW, outH, nullptr);
+    return decoded ? ESP_OK : ESP_FAIL;
+}
+
+typedef struct {
+    const uint8_t* input;
+    uint8_t* output;
+    uint16_t width;
+} bmp_decoder_t;
+
+static unsigned int _bmp_jpg_read(void* arg, size_t index, uint8_t* buf, size_t len) {
+    bmp_decoder_t* jpeg = (bmp_decoder_t*)arg;
+    if (buf) memcpy(buf, jpeg->input + index, len);
+    return len;
+}
+
+static bool _bmp_rgb_write(void* arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t* data) {
+    bmp_decoder_t* jpeg = (bmp_decoder_t*)arg;
+    if (!data) {
+        if (x == 0 && y == 0) jpeg->width = w;
+        return true;
+    }
+    for (int iy = 0; iy < h; iy++) {
+        uint8_t* o = jpeg->output + ((size_t)(y + iy) * jpeg->width + x) * 3;
+        for (int ix = 0; ix < w; ix++) {
+            // BMP pixels are B G R
+            o[0] = data[2];
+            o[1] = data[1];
+            o[2] = data[0];
+            o += 3;
+            data += 3;
+        }
+    }
+    return true;
+}
+
+// As in esp32-camera: 24 bit, top-down (negative height), rows not padded
+bool fmt2bmp(uint8_t* src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t** out, size_t* out_len) {
+    const size_t headerLen = 54;
+    size_t pixels = (size_t)width * height;
+    size_t outLen = headerLen + pixels * 3;
+    uint8_t* bmp = new uint8_t[outLen];
+    memset(bmp, 0, headerLen);
+    bmp[0] = 'B';
+    bmp[1] = 'M';
+    uint32_t* h = (uint32_t*)(bmp + 2);
+    h[0] = outLen;
+    h[1] = 0;
+    h[2] = headerLen;
+    h[3] = 40;
+    *(int32_t*)(bmp + 0x12) = width;
+    *(int32_t*)(bmp + 0x16) = -(int32_t)height;
+    *(uint16_t*)(bmp + 0x1A) = 1;
+    *(uint16_t*)(bmp + 0x1C) = 24;
+    *(uint32_t*)(bmp + 0x22) = pixels * 3;
+    *(uint32_t*)(bmp + 0x26) = 0x0B13;
+    *(uint32_t*)(bmp + 0x2A) = 0x0B13;
+    uint8_t* o = bmp + headerLen;
+    switch (format) {
+        case PIXFORMAT_RGB565:
+            for (size_t i = 0; i < pixels; i++) {
+                uint8_t hb = src[2 * i];
+                uint8_t lb = src[2 * i + 1];
+                *o++ = (lb & 0x1F) << 3;
+                *o++ = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+                *o++ = hb & 0xF8;
+            }
+            break;
+        case PIXFORMAT_RGB888:
+            memcpy(o, src, pixels * 3);
+            break;
+        case PIXFORMAT_GRAYSCALE:
+            for (size_t i = 0; i < pixels; i++) {
+                *o++ = src[i];
+                *o++ = src[i];
+                *o++ = src[i];
+            }
+            break;
+        case PIXFORMAT_JPEG: {
+            bmp_decoder_t jpeg = { src, o, 0 };
+            if (esp_jpg_decode(src_len, JPG_SCALE_NONE, _bmp_jpg_read, _bmp_rgb_write, &jpeg) != ESP_OK || jpeg.width != width) {
+                delete[] bmp;
+                return false;
+            }
+            break;
+        }
+        default:
+            delete[] bmp;
+            return false;
+    }
+    *out = bmp;
+    *out_len = outLen;
+    return true;
+}
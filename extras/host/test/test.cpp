@@ -0,0 +1,570 @@
+/*
+** Correctness tests of the host build
+**
+** Each test checks a property the library promises (a fast path agrees with the plain loop, a conversion
+** round-trips, a file format reads back) on small generated images. Failed checks are reported with their
+** line and the run exits non-zero.
+**
+**   esp_image_test [--filter <substring>]
+*/
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <ftw.h>
+#include <functional>
+#include <vector>
+#include "esp_image.h"
+#include "esp_image_writer.h"
+
+static int failedChecks = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("    %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        failedChecks++; \
+    } \
+} while (0)
+
+#define CHECK_THROWS(statement) do { \
+    bool threw = false; \
+    try { statement; } catch (const std::exception&) { threw = true; } \
+    if (!threw) { \
+        printf("    %s:%d: %s did not throw\n", __FILE__, __LINE__, #statement); \
+        failedChecks++; \
+    } \
+} while (0)
+
+// ---- Images ----------------------------------------------------------------------------------
+
+static uint32_t lcg(uint32_t& seed) {
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 8;
+}
+
+// Big-endian RGB565 of a gradient with noise, and a second frame that differs from it in places
+static void generateRgb565(int width, int height, uint32_t seed, std::vector<uint8_t>& out) {
+    out.resize((size_t)width * height * 2);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int n = (int)(lcg(seed) & 31) - 16;
+            int r = x * 255 / width + n;
+            int g = y * 255 / height - n;
+            int b = (lcg(seed) & 0xFF);
+            r = r < 0 ? 0 : r > 255 ? 255 : r;
+            g = g < 0 ? 0 : g > 255 ? 255 : g;
+            uint16_t c = (r & 0xF8) << 8 | (g & 0xFC) << 3 | b >> 3;
+            size_t i = 2 * ((size_t)y * width + x);
+            out[i] = c >> 8;
+            out[i + 1] = c & 0xFF;
+        }
+    }
+}
+
+static void loadRgb565(Image& image, std::vector<uint8_t>& pixels, int width, int height) {
+    image.fromBuffer(pixels.data(), width, height, pixels.size(), IMAGE_RGB565).load();
+}
+
+static bool sameContent(Image& a, Image& b) {
+    return a.type == b.type && a.width == b.width && a.height == b.height && a.len == b.len && memcmp(a.buffer, b.buffer, a.len) == 0;
+}
+
+static bool checkerboard(int x, int y, int width, int height) {
+    return ((x / 3) + (y / 2)) % 2 == 0;
+}
+
+// ---- Tests -----------------------------------------------------------------------------------
+
+struct Test {
+    const char* name;
+    std::function<void(FS&)> run;
+};
+
+static std::vector<Test> tests() {
+    std::vector<Test> tests;
+
+    // compareGreyThreshold() counts runs with the row kernels; it must agree with the per-pixel compareWith()
+    tests.push_back({ "compare/grey-threshold-matches-lambda", [](FS&) {
+        const int sizes[][2] = { { 1, 1 }, { 7, 5 }, { 15, 9 }, { 17, 3 }, { 33, 31 }, { 101, 40 } };
+        for (auto& size : sizes) {
+            int width = size[0], height = size[1];
+            std::vector<uint8_t> a, b;
+            generateRgb565(width, height, 1, a);
+            generateRgb565(width, height, 2, b);
+            Image thisImage, thatImage;
+            loadRgb565(thisImage, a, width, height);
+            loadRgb565(thatImage, b, width, height);
+            Mask circle(width, height, insideCircle);
+            Mask board(width, height, checkerboard);
+            for (int stride = 1; stride <= 3; stride++) {
+                for (int threshold : { 0, 8, 40 }) {
+                    auto differs = [threshold](int x, int y, Pixel p1, Pixel p2) { return abs(p1.grey() - p2.grey()) > threshold; };
+                    CHECK(thisImage.compareGreyThreshold(thatImage, threshold, stride) == thisImage.compareWith(thatImage, stride, differs));
+                    CHECK(thisImage.compareGreyThreshold(thatImage, threshold, stride, checkerboard) == thisImage.compareWith(thatImage, stride, differs, checkerboard));
+                    if (stride == 1 || width > 2) {
+                        CHECK(thisImage.compareGreyThreshold(thatImage, threshold, stride, board) == thisImage.compareWith(thatImage, stride, differs, board));
+                    }
+                    if (circle.count() > 0) {
+                        CHECK(thisImage.compareGreyThreshold(thatImage, threshold, stride, circle) == thisImage.compareWith(thatImage, stride, differs, circle));
+                    }
+                }
+            }
+        }
+    }});
+
+    tests.push_back({ "compare/grey-threshold-native-and-grey8", [](FS&) {
+        int width = 45, height = 13;
+        std::vector<uint8_t> a, b;
+        generateRgb565(width, height, 3, a);
+        generateRgb565(width, height, 4, b);
+        Image thisImage, thatImage;
+        loadRgb565(thisImage, a, width, height);
+        loadRgb565(thatImage, b, width, height);
+        float camera = thisImage.compareGreyThreshold(thatImage, 12);
+        Image thisGrey, thatGrey;
+        thisGrey.fromImage(thisImage).convertTo(IMAGE_GRAYSCALE8);
+        thatGrey.fromImage(thatImage).convertTo(IMAGE_GRAYSCALE8);
+        CHECK(thisGrey.compareGreyThreshold(thatGrey, 12) == camera);
+        thisImage.setPixelOrder(PIXEL_ORDER_NATIVE);
+        thatImage.setPixelOrder(PIXEL_ORDER_NATIVE);
+        CHECK(thisImage.compareGreyThreshold(thatImage, 12) == camera);
+        CHECK(thisImage.compareGreyThreshold(thatImage, 12, 2, checkerboard) == thisImage.compareWith(thatImage, 2, [](int x, int y, Pixel p1, Pixel p2) {
+            return abs(p1.grey() - p2.grey()) > 12;
+        }, checkerboard));
+    }});
+
+    // Every uncompressed type converts to every other; the lossless pairs must come back unchanged
+    tests.push_back({ "convert/matrix-round-trips", [](FS&) {
+        int width = 23, height = 11;
+        std::vector<uint8_t> pixels;
+        generateRgb565(width, height, 5, pixels);
+        Image rgb;
+        loadRgb565(rgb, pixels, width, height);
+        const image_type_t types[] = { IMAGE_RGB565, IMAGE_RGB888, IMAGE_GRAYSCALE8, IMAGE_BMP };
+        for (image_type_t from : types) {
+            Image source;
+            if (from == IMAGE_RGB565) {
+                source.fromImage(rgb).load();
+            } else {
+                source.fromImage(rgb).convertTo(from);
+            }
+            for (image_type_t to : types) {
+                if (to == from) continue;
+                Image target;
+                target.fromImage(source).convertTo(to);
+                CHECK(target.type == to && target.width == width && target.height == height);
+                Image back;
+                back.fromImage(target).convertTo(from);
+                // Grey is not restored from colour as the Pixel::grey() weights add up to a little under 1
+                bool lossless = to != IMAGE_GRAYSCALE8 && from != IMAGE_GRAYSCALE8;
+                if (lossless) {
+                    CHECK(sameContent(back, source));
+                }
+            }
+        }
+        // Grey becomes equal B, G and R
+        Image grey;
+        grey.fromImage(rgb).convertTo(IMAGE_GRAYSCALE8);
+        Image bgr;
+        bgr.fromImage(grey).convertTo(IMAGE_RGB888);
+        bool equal = true;
+        for (size_t i = 0; i < grey.len; i++) {
+            equal &= bgr.buffer[3 * i] == grey.buffer[i] && bgr.buffer[3 * i + 1] == grey.buffer[i] && bgr.buffer[3 * i + 2] == grey.buffer[i];
+        }
+        CHECK(equal);
+    }});
+
+    tests.push_back({ "convert/native-order-matches-camera", [](FS&) {
+        int width = 19, height = 7;
+        std::vector<uint8_t> pixels;
+        generateRgb565(width, height, 6, pixels);
+        Image camera, native;
+        loadRgb565(camera, pixels, width, height);
+        loadRgb565(native, pixels, width, height);
+        native.setPixelOrder(PIXEL_ORDER_NATIVE);
+        Image cameraBgr, nativeBgr;
+        cameraBgr.fromImage(camera).convertTo(IMAGE_RGB888);
+        nativeBgr.fromImage(native).convertTo(IMAGE_RGB888);
+        CHECK(sameContent(cameraBgr, nativeBgr));
+    }});
+
+    // Every byte and the JSON specials must come back as they went in
+    tests.push_back({ "metadata/escaping-round-trips", [](FS&) {
+        std::map<String, String> metadata;
+        String everyByte;
+        for (int c = 1; c < 256; c++) everyByte.concat((char)c);
+        metadata["every byte"] = everyByte;
+        metadata["quote \" and \\ backslash"] = "line\nbreak\ttab\r\b\f";
+        metadata["empty"] = "";
+        metadata[""] = "empty label";
+        String json;
+        metadata_json::write(metadata, json);
+        std::map<String, String> parsed;
+        size_t errorAt = 0;
+        CHECK(metadata_json::parse(json.c_str(), json.length(), parsed, errorAt));
+        CHECK(parsed == metadata);
+        // Escapes written by other tools
+        const char* other = "{ \"metadata\" : [{ \"value\": \"\\u00e9\\ud83d\\ude00\\/\", \"label\": \"x\" }] }";
+        parsed.clear();
+        CHECK(metadata_json::parse(other, strlen(other), parsed, errorAt));
+        CHECK(parsed["x"] == "\xC3\xA9\xF0\x9F\x98\x80/");
+        // Files from before escaping have no commas between entries
+        const char* old = "{ \"metadata\" : [{ \"label\": \"a\", \"value\": \"1\" }\n{ \"label\": \"b\", \"value\": \"2\" }\n]\n}";
+        parsed.clear();
+        CHECK(metadata_json::parse(old, strlen(old), parsed, errorAt) && parsed.size() == 2 && parsed["b"] == "2");
+        const char* bad = "{ \"metadata\" : [{ \"label\": \"a\", \"value\": \"\\q\" }] }";
+        CHECK(!metadata_json::parse(bad, strlen(bad), parsed, errorAt));
+    }});
+
+    // Resampling a flat image must keep it flat whatever the ratio, and resizing to the same size must not change it
+    tests.push_back({ "resize/flat-stays-flat", [](FS&) {
+        const resize_method_t methods[] = { RESIZE_NEAREST, RESIZE_BILINEAR, RESIZE_AREA };
+        const int shapes[][4] = {
+            { 1600, 8, 1, 8 }, { 1600, 8, 5, 8 }, { 1600, 8, 10, 3 }, { 1600, 8, 12, 8 }, { 1600, 8, 20, 8 }, { 1600, 8, 96, 8 },
+            { 8, 1600, 8, 1 }, { 8, 1600, 3, 7 }, { 640, 480, 1, 1 }, { 3, 2, 1200, 5 }, { 1, 1, 300, 200 }, { 7, 5, 11, 13 }
+        };
+        const image_type_t types[] = { IMAGE_GRAYSCALE8, IMAGE_RGB565, IMAGE_RGB888 };
+        for (auto& shape : shapes) {
+            std::vector<uint8_t> grey((size_t)shape[0] * shape[1], 100);
+            Image flatGrey;
+            flatGrey.fromBuffer(grey.data(), shape[0], shape[1], grey.size(), IMAGE_GRAYSCALE8).load();
+            for (image_type_t type : types) {
+                Image flat;
+                if (type == IMAGE_GRAYSCALE8) {
+                    flat.fromImage(flatGrey).load();
+                } else {
+                    flat.fromImage(flatGrey).convertTo(type);
+                }
+                for (resize_method_t method : methods) {
+                    Image resized;
+                    resized.fromImage(flat).resize(shape[2], shape[3], method);
+                    CHECK(resized.type == type && resized.width == shape[2] && resized.height == shape[3]);
+                    bool stayedFlat = true;
+                    int pixelBytes = resized.bytesPerPixel();
+                    for (size_t i = 0; i < resized.len; i++) {
+                        stayedFlat &= resized.buffer[i] == flat.buffer[i % pixelBytes];
+                    }
+                    if (!stayedFlat) {
+                        printf("    %s %dx%d to %dx%d by method %d is not flat\n", imageTypeName[type], shape[0], shape[1], shape[2], shape[3], method);
+                    }
+                    CHECK(stayedFlat);
+                }
+            }
+        }
+    }});
+
+    tests.push_back({ "resize/same-size-is-lossless", [](FS&) {
+        int width = 37, height = 21;
+        std::vector<uint8_t> pixels;
+        generateRgb565(width, height, 11, pixels);
+        Image rgb;
+        loadRgb565(rgb, pixels, width, height);
+        const image_type_t types[] = { IMAGE_RGB565, IMAGE_RGB888, IMAGE_GRAYSCALE8 };
+        for (image_type_t type : types) {
+            Image source;
+            if (type == IMAGE_RGB565) {
+                source.fromImage(rgb).load();
+            } else {
+                source.fromImage(rgb).convertTo(type);
+            }
+            for (resize_method_t method : { RESIZE_NEAREST, RESIZE_BILINEAR, RESIZE_AREA }) {
+                Image resized;
+                resized.fromImage(source).resize(width, height, method);
+                CHECK(sameContent(resized, source));
+            }
+        }
+    }});
+
+    // A static scene does not drift: the model settles as close below the scene as above it
+    tests.push_back({ "background/no-drift", [](FS&) {
+        int width = 8, height = 8;
+        for (int start : { 99, 101 }) {
+            BackgroundModel model(1.0f / 256);
+            std::vector<uint8_t> first((size_t)width * height, start), scene((size_t)width * height, 100);
+            Image frame;
+            frame.fromBuffer(first.data(), width, height, first.size(), IMAGE_GRAYSCALE8).load();
+            model.update(frame, 10);
+            frame.fromBuffer(scene.data(), width, height, scene.size(), IMAGE_GRAYSCALE8).load();
+            for (int i = 0; i < 400; i++) {
+                model.update(frame, 10);
+            }
+            CHECK(model.meanAt(0, 0) == 100 && model.meanAt(width - 1, height - 1) == 100);
+            Image background;
+            model.backgroundImage(background);
+            CHECK(background.buffer[0] == 100);
+        }
+        CHECK_THROWS(BackgroundModel(0.05, true, 64));
+        CHECK_THROWS(BackgroundModel(0.05, true, -1));
+    }});
+
+    // Tap positions of wide images, whose products of output index and source size pass 2^31
+    tests.push_back({ "resize/wide-taps", [](FS&) {
+        const int sizes[][2] = { { 40000, 30000 }, { 65535, 65534 }, { 50000, 60000 } };
+        for (auto& size : sizes) {
+            for (resize_method_t method : { RESIZE_NEAREST, RESIZE_BILINEAR, RESIZE_AREA }) {
+                image_kernels::ResizeTaps taps(size[0], size[1], method);
+                bool inRange = true;
+                for (int i = 0; i < size[1]; i++) {
+                    inRange &= taps.first[i] >= 0 && taps.first[i] + taps.count[i] <= size[0];
+                    if (method == RESIZE_NEAREST) {
+                        inRange &= taps.first[i] == (int)(((int64_t)2 * i + 1) * size[0] / (2 * (int64_t)size[1]));
+                    }
+                }
+                CHECK(inRange);
+            }
+        }
+    }});
+
+    // A region of a JPEG matches the same part of a full decode, and one the data runs out before is refused
+    tests.push_back({ "jpeg/region-decode", [](FS&) {
+        int width = 64, height = 48, top = 32;
+        std::vector<uint8_t> pixels;
+        generateRgb565(width, height, 14, pixels);
+        Image rgb, jpeg, full, region;
+        loadRgb565(rgb, pixels, width, height);
+        jpeg.fromImage(rgb).convertTo(IMAGE_JPEG);
+        full.fromImage(jpeg).convertTo(IMAGE_RGB565);
+        region.fromImage(jpeg).region(0, top, width, height - top).convertTo(IMAGE_RGB565);
+        CHECK(region.width == width && region.height == height - top);
+        CHECK(memcmp(region.buffer, full.buffer + (size_t)top * width * 2, region.len) == 0);
+        for (size_t len : { jpeg.len / 2, jpeg.len - 8 }) {
+            Image truncated, bottom;
+            truncated.fromBuffer(jpeg.buffer, width, height, len, IMAGE_JPEG).load();
+            CHECK_THROWS(bottom.fromImage(truncated).region(0, top, width, height - top).convertTo(IMAGE_RGB565));
+        }
+    }});
+
+    // Metadata of a JPEG lives in one APP9 segment that is replaced on every save
+    tests.push_back({ "metadata/jpeg-app9", [](FS& fs) {
+        int width = 32, height = 24;
+        std::vector<uint8_t> pixels;
+        generateRgb565(width, height, 7, pixels);
+        Image rgb, jpeg;
+        loadRgb565(rgb, pixels, width, height);
+        jpeg.fromImage(rgb).convertTo(IMAGE_JPEG);
+        jpeg.metadata["label"] = "first \"value\"";
+        // A sidecar from an earlier save goes, as load would fall back to it for a JPEG without a segment
+        fs.mkdir("/app9");
+        File sidecar = fs.open("/app9/image.json", FILE_WRITE);
+        const char* stale = "{\"stale\":\"yes\"}";
+        sidecar.write((const uint8_t*)stale, strlen(stale));
+        sidecar.close();
+        jpeg.toFile(fs, "/app9/image.jpg").save();
+        JpegInfo info = Image::probe(fs, "/app9/image.jpg");
+        CHECK(info.valid && info.width == width && info.height == height);
+        CHECK(info.appCount == 1 && info.app[0].n == 9);
+        CHECK(!fs.exists("/app9/image.json"));
+        Image loaded;
+        loaded.fromFile(fs, "/app9/image.jpg").load();
+        CHECK(loaded.metadata.size() == 1 && loaded.metadata["label"] == "first \"value\"");
+        // Saving again replaces the segment rather than adding another
+        loaded.metadata["label"] = "second";
+        loaded.metadata["more"] = "yes";
+        loaded.toFile(fs, "/app9/image.jpg").save();
+        info = Image::probe(fs, "/app9/image.jpg");
+        CHECK(info.appCount == 1 && info.app[0].n == 9);
+        Image reloaded;
+        reloaded.fromFile(fs, "/app9/image.jpg").load();
+        CHECK(reloaded.metadata.size() == 2 && reloaded.metadata["label"] == "second");
+        // Read straight from the file by the decoder as well
+        Image decoded;
+        decoded.fromFile(fs, "/app9/image.jpg").convertTo(IMAGE_GRAYSCALE8);
+        CHECK(decoded.metadata["more"] == "yes");
+        // No metadata, no segment
+        reloaded.metadata.clear();
+        reloaded.toFile(fs, "/app9/image.jpg").save();
+        info = Image::probe(fs, "/app9/image.jpg");
+        CHECK(info.appCount == 0 && info.scanOffset > 0);
+        CHECK(!fs.exists("/app9/image.json"));
+        Image cleared;
+        cleared.fromFile(fs, "/app9/image.jpg").load();
+        CHECK(cleared.metadata.size() == 0);
+    }});
+
+    // The highest quality that fits, never over the target unless even the lowest quality is
+    tests.push_back({ "jpeg/target-size-bisection", [](FS&) {
+        int width = 96, height = 64;
+        std::vector<uint8_t> pixels;
+        generateRgb565(width, height, 8, pixels);
+        Image rgb;
+        loadRgb565(rgb, pixels, width, height);
+        size_t sizes[101];
+        for (int quality = 1; quality <= 100; quality++) {
+            Image jpeg;
+            jpeg.fromImage(rgb).convertTo(IMAGE_JPEG, quality);
+            CHECK(jpeg.jpegInfo().quality == quality);
+            sizes[quality] = jpeg.len;
+        }
+        const int ranges[][2] = { { 1, 100 }, { 10, 40 }, { 50, 50 }, { 30, 90 } };
+        for (auto& range : ranges) {
+            for (size_t target : { sizes[100] + 1, sizes[100], sizes[60], sizes[25] - 1, sizes[1], sizes[1] - 1, (size_t)1 }) {
+                Image jpeg;
+                jpeg.fromImage(rgb).convertTo(IMAGE_JPEG, target, range[0], range[1]);
+                int quality = jpeg.jpegInfo().quality;
+                CHECK(quality >= range[0] && quality <= range[1]);
+                CHECK(jpeg.len == sizes[quality]);
+                int best = range[1];
+                while (best > range[0] && sizes[best] > target) best--;
+                CHECK(quality == best);
+                CHECK(jpeg.len <= target || quality == range[0]);
+            }
+        }
+        Image jpeg;
+        CHECK_THROWS(jpeg.fromImage(rgb).convertTo(IMAGE_JPEG, (size_t)1000, 50, 40));
+        CHECK_THROWS(jpeg.fromImage(rgb).convertTo(IMAGE_RGB888, 50));
+        // Not truncated into range on the way in
+        CHECK_THROWS(jpeg.fromImage(rgb).convertTo(IMAGE_JPEG, 300));
+        CHECK_THROWS(jpeg.fromImage(rgb).convertTo(IMAGE_JPEG, 0));
+        CHECK_THROWS(jpeg.fromImage(rgb).convertTo(IMAGE_JPEG, (size_t)1000, 257, 300));
+        CHECK_THROWS(jpeg.fromImage(rgb).convertTo(IMAGE_JPEG, (size_t)1000, 10, 356));
+    }});
+
+    // Row bands run on a ThreadPool must give exactly the serial results
+    tests.push_back({ "executor/pool-matches-serial", [](FS&) {
+        ThreadPool one(1), two(2), three(3), eight(8);
+        ThreadPool* pools[] = { &one, &two, &three, &eight };
+        const int sizes[][2] = { { 5, 3 }, { 64, 48 }, { 97, 131 }, { 320, 17 } };
+        for (auto& size : sizes) {
+            int width = size[0], height = size[1];
+            std::vector<uint8_t> a, b;
+            generateRgb565(width, height, 9, a);
+            generateRgb565(width, height, 10, b);
+            Image thisImage, thatImage, thisGrey, thatGrey;
+            loadRgb565(thisImage, a, width, height);
+            loadRgb565(thatImage, b, width, height);
+            thisGrey.fromImage(thisImage).convertTo(IMAGE_GRAYSCALE8);
+            thatGrey.fromImage(thatImage).convertTo(IMAGE_GRAYSCALE8);
+            Mask circle(width, height, insideCircle);
+            auto differs = [](int x, int y, Pixel p1, Pixel p2) { return abs(p1.grey() - p2.grey()) > 10; };
+            auto results = [&]() {
+                std::vector<double> r;
+                r.push_back(thisImage.compareWith(thatImage, differs));
+                r.push_back(thisImage.compareWith(thatImage, 3, differs, insideCircle));
+                r.push_back(thisImage.compareWith(thatImage, 2, differs, circle));
+                r.push_back(thisImage.compareGreyThreshold(thatImage, 10));
+                r.push_back(thisImage.compareGreyThreshold(thatImage, 10, 2, checkerboard));
+                r.push_back(thisImage.compareGreyThreshold(thatImage, 10, 1, circle));
+                r.push_back(thisGrey.compareGreyThreshold(thatGrey, 10, 3));
+                r.push_back(thisImage.maxGrey());
+                r.push_back(thisImage.minGrey(circle));
+                ImageStats stats = thisImage.stats(maskFunction(checkerboard), true);
+                r.push_back(stats.mean);
+                r.push_back(stats.variance);
+                for (int i = 0; i < 256; i++) r.push_back(stats.histogram[i] + stats.red[i] * 1e-3 + stats.blue[i] * 1e-6);
+                std::atomic<long> total(0);
+                thisImage.foreachPixel(maskFunction(), [&](int x, int y, Pixel pixel) { total += (long)pixel.grey() * (x + 1) * (y + 1); });
+                r.push_back(total);
+                total = 0;
+                thisImage.foreachPixel(circle, [&](int x, int y, Pixel pixel) { total += (long)pixel.grey() * (x + 2) * (y + 3); });
+                r.push_back(total);
+                return r;
+            };
+            std::vector<double> serial = results();
+            for (ThreadPool* pool : pools) {
+                thisImage.setExecutor(pool);
+                thisGrey.setExecutor(pool);
+                CHECK(results() == serial);
+            }
+        }
+    }});
+
+    // An exception in a band reaches the caller of run() and leaves the pool usable
+    tests.push_back({ "executor/band-exceptions", [](FS&) {
+        ThreadPool pool(4);
+        for (int thrower : { 0, 5 }) {
+            CHECK_THROWS(pool.run(8, [thrower](int band) {
+                if (band == thrower) throw LogicError("band failed");
+            }));
+            std::atomic<int> ran(0);
+            pool.run(8, [&ran](int band) { ran++; });
+            CHECK(ran == 8);
+        }
+        int width = 64, height = 64;
+        std::vector<uint8_t> pixels;
+        generateRgb565(width, height, 12, pixels);
+        Image image;
+        loadRgb565(image, pixels, width, height);
+        image.setExecutor(&pool);
+        CHECK_THROWS(image.compareWith(image, [](int x, int y, Pixel p1, Pixel p2) {
+            if (y == 50) throw LogicError("compare failed");
+            return false;
+        }));
+        CHECK(image.compareGreyThreshold(image, 0) == 0);
+    }});
+
+    // A callback writing to a full WRITER_BLOCK queue has its image dropped rather than waiting on itself
+    tests.push_back({ "writer/block-from-callback", [](FS& fs) {
+        int width = 32, height = 24;
+        std::vector<uint8_t> pixels;
+        generateRgb565(width, height, 13, pixels);
+        Image rgb, jpeg;
+        loadRgb565(rgb, pixels, width, height);
+        jpeg.fromImage(rgb).convertTo(IMAGE_JPEG);
+        std::atomic<int> written(0), dropped(0);
+        std::vector<bool> accepted;
+        image_write_callback_t count = [&](Image&, const String&, image_write_result_t result, const String&) {
+            if (result == IMAGE_WRITTEN) written++;
+            if (result == IMAGE_DROPPED) dropped++;
+        };
+        ImageWriter writer(1, WRITER_BLOCK);
+        Image first;
+        first.fromImage(jpeg).load();
+        writer.write(first, fs, "/writer/0.jpg", [&](Image&, const String&, image_write_result_t result, const String&) {
+            if (result == IMAGE_WRITTEN) written++;
+            for (int i = 1; i <= 3; i++) {
+                Image next;
+                next.fromImage(jpeg).load();
+                accepted.push_back(writer.write(next, fs, StringF("/writer/%d.jpg", i), count));
+            }
+        });
+        writer.flush();
+        CHECK(accepted.size() == 3 && accepted[0] && !accepted[1] && !accepted[2]);
+        CHECK(written == 2 && dropped == 2);
+        CHECK(fs.exists("/writer/1.jpg") && !fs.exists("/writer/2.jpg"));
+        CHECK(writer.stats().dropped == 2);
+    }});
+
+    return tests;
+}
+
+// ---- Runner ----------------------------------------------------------------------------------
+
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+int main(int argc, char** argv) {
+    String filter;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--filter") && i + 1 < argc) filter = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [--filter <substring>]\n", argv[0]);
+            return 1;
+        }
+    }
+    char rootDir[] = "/tmp/esp_image_test.XXXXXX";
+    if (!mkdtemp(rootDir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    FS fs(rootDir);
+    int failedTests = 0;
+    int run = 0;
+    for (const Test& test : tests()) {
+        if (filter.length() && String(test.name).indexOf(filter) < 0) continue;
+        int failedBefore = failedChecks;
+        try {
+            test.run(fs);
+        } catch (std::exception const& ex) {
+            printf("    threw: %s\n", ex.what());
+            failedChecks++;
+        }
+        bool passed = failedChecks == failedBefore;
+        printf("%-48s %s\n", test.name, passed ? "ok" : "FAILED");
+        failedTests += passed ? 0 : 1;
+        run++;
+        fflush(stdout);
+    }
+    printf("%d of %d tests passed\n", run - failedTests, run);
+    nftw(rootDir, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    return failedTests ? 2 : 0;
+}
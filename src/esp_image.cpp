@@ -1,4 +1,5 @@
 #include "esp_image.h"
+#include "esp_image_kernels.h"
 
 const char* imageTypeName[IMAGE_MAX] = {
     "None",
@@ -23,9 +24,167 @@ const char* pixFormat[9] = {
 uint8_t jpg_sig[] = { 0xFF, 0xD8};
 uint8_t bmp_sig[] = { 0x42, 0x4D};
 
+// Read from a JPEG file through its window, going back to the file only when the decoder moves outside it
+static unsigned int _jpg_window_read(jpg_file_window_t* window, size_t index, uint8_t* buf, size_t len) {
+    if (!buf) {
+        return len;  // Skipped data is never read
+    }
+    size_t done = 0;
+    while (done < len) {
+        size_t at = index + done;
+        if (at < window->start || at >= window->start + window->len) {
+            if (window->file->position() != at && !window->file->seek(at)) break;
+            window->start = at;
+            window->len = window->file->read(window->data, window->size);
+            if (window->len == 0) break;
+        }
+        size_t n = window->start + window->len - at;
+        if (n > len - done) n = len - done;
+        memcpy(buf + done, window->data + (at - window->start), n);
+        done += n;
+    }
+    return done;
+}
+// libjpeg's luma quantisation table at quality 50. Quality scales every entry by the same factor so the
+// order of the entries (natural or zigzag) does not matter when comparing sums
+static const uint8_t _jpg_std_luma_quant[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+};
+// The libjpeg quality whose luma table is closest to one with this sum of entries
+static uint8_t _jpg_estimate_quality(uint32_t tableSum, int maxEntry) {
+    uint8_t best = 1;
+    uint32_t bestError = UINT32_MAX;
+    for (int quality = 1; quality <= 100; quality++) {
+        int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+        uint32_t sum = 0;
+        for (int i = 0; i < 64; i++) {
+            int q = (_jpg_std_luma_quant[i] * scale + 50) / 100;
+            sum += q < 1 ? 1 : q > maxEntry ? maxEntry : q;
+        }
+        uint32_t error = sum > tableSum ? sum - tableSum : tableSum - sum;
+        if (error < bestError) {
+            best = quality;
+            bestError = error;
+        }
+    }
+    return best;
+}
+// Walk the segments of a JPEG as far as the start of the scan, reading them with read(offset, buf, len) so that
+// the same walk serves a buffer and a file. Segments of no interest (e.g. Huffman tables) are skipped unread
+template<typename Reader>
+static bool _jpg_parse_info(Reader read, size_t jpegLen, JpegInfo& info) {
+    info = JpegInfo();
+    uint8_t seg[4 + 6 + 3 * 4];  // FF marker, length and as much of a SOFn segment as is kept
+    if (read(0, seg, 2) != 2 || seg[0] != jpg_sig[0] || seg[1] != jpg_sig[1]) {
+        return false;
+    }
+    size_t index = 2;
+    while (index + 4 <= jpegLen && read(index, seg, 4) == 4) {
+        uint8_t marker = seg[1];
+        if (seg[0] != 0xFF) {
+            return false;
+        }
+        if (marker == 0xFF) {
+            index++;  // Fill byte
+            continue;
+        }
+        if (marker == 0xDA) {
+            info.scanOffset = index;
+            break;
+        }
+        if (marker == 0xD9) {
+            break;
+        }
+        size_t segLen = seg[2] << 8 | seg[3];
+        if (segLen < 2) {
+            return false;
+        }
+        if (marker >= 0xE0 && marker <= 0xEF) {
+            if (info.appCount < JPEG_INFO_MAX_APP) {
+                jpeg_app_segment_t& app = info.app[info.appCount++];
+                app.n = marker - 0xE0;
+                app.offset = index;
+                app.length = 2 + segLen;
+            }
+        } else
+        if (marker == 0xDB) {
+            // One or more tables, each a precision/id byte then 64 entries of 8 or 16 bits
+            size_t tableIndex = index + 4;
+            while (tableIndex < index + 2 + segLen) {
+                uint8_t table[1 + 128];
+                if (read(tableIndex, table, 1) != 1) return false;
+                size_t entryBytes = (table[0] >> 4) ? 2 : 1;
+                if (read(tableIndex + 1, table + 1, 64 * entryBytes) != 64 * entryBytes) return false;
+                if ((table[0] & 0x0F) == 0) {
+                    uint32_t sum = 0;
+                    for (int i = 0; i < 64; i++) {
+                        sum += entryBytes == 2 ? (table[1 + 2 * i] << 8 | table[2 + 2 * i]) : table[1 + i];
+                    }
+                    info.quality = _jpg_estimate_quality(sum, entryBytes == 2 ? 32767 : 255);
+                }
+                tableIndex += 1 + 64 * entryBytes;
+            }
+        } else
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // SOFn: precision, height, width, component count then id, sampling factors and table of each
+            size_t keep = segLen - 2 < sizeof(seg) - 4 ? segLen - 2 : sizeof(seg) - 4;
+            if (keep < 6 || read(index + 4, seg + 4, keep) != keep) return false;
+            info.valid = true;
+            info.sofType = marker - 0xC0;
+            info.precision = seg[4];
+            info.height = seg[5] << 8 | seg[6];
+            info.width = seg[7] << 8 | seg[8];
+            info.components = seg[9];
+            for (int c = 0; c < info.components && c < 4 && 6 + 3 * c + 2 < (int)keep; c++) {
+                info.sampling[c] = seg[4 + 6 + 3 * c + 1];
+            }
+        }
+        index += 2 + segLen;
+    }
+    return info.valid;
+}
+// Where the metadata JSON of a JPEG is, if it has an APP9 segment that starts with JPEG_METADATA_ID
+template<typename Reader>
+static bool _jpg_find_metadata(Reader read, const JpegInfo& info, size_t& offset, size_t& len) {
+    for (int i = 0; i < info.appCount; i++) {
+        const jpeg_app_segment_t& app = info.app[i];
+        uint8_t id[JPEG_METADATA_ID_LEN];
+        if (app.n == 9 && app.length >= 4 + JPEG_METADATA_ID_LEN && read(app.offset + 4, id, sizeof(id)) == sizeof(id)
+            && !memcmp(id, JPEG_METADATA_ID, JPEG_METADATA_ID_LEN)) {
+            offset = app.offset + 4 + JPEG_METADATA_ID_LEN;
+            len = app.length - 4 - JPEG_METADATA_ID_LEN;
+            return true;
+        }
+    }
+    return false;
+}
+// Reader over a JPEG in memory for _jpg_parse_info()
+typedef struct {
+    const uint8_t* buffer;
+    size_t len;
+    size_t operator()(size_t offset, uint8_t* buf, size_t n) const {
+        if (offset >= len) return 0;
+        if (n > len - offset) n = len - offset;
+        memcpy(buf, buffer + offset, n);
+        return n;
+    }
+} jpg_buffer_reader_t;
+// Reader through the window onto a JPEG file for _jpg_parse_info()
+typedef struct {
+    jpg_file_window_t* window;
+    size_t operator()(size_t offset, uint8_t* buf, size_t n) const {
+        return _jpg_window_read(window, offset, buf, n);
+    }
+} jpg_window_reader_t;
 // JPG reader
 static unsigned int _jpg_read(void * arg, size_t index, uint8_t *buf, size_t len) {
     jpg_decoder * jpeg = (jpg_decoder *)arg;
+    if (jpeg->window) {
+        return _jpg_window_read(jpeg->window, index, buf, len);
+    }
     if(buf) {
         memcpy(buf, jpeg->input + index, len);
     }
@@ -33,7 +192,8 @@ static unsigned int _jpg_read(void * arg, size_t index, uint8_t *buf, size_t len
 }
 // Need a copy of this from esp32-camera/conversions/to_bmp.c so we can extract the source JPEG size 
 // when doing the RGB565 conversion. Also need to alter the byte order to big-endian for compatibility
-// with the RGB565 to BMP conversions
+// with the RGB565 to BMP conversions, unless the target Image is in native order
+template<bool Native>
 static bool _rgb565_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
     jpg_decoder * jpeg = (jpg_decoder *)arg;
     if(!data){
@@ -70,18 +230,356 @@ static bool _rgb565_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16
             uint16_t g = data[ix+1];
             uint16_t b = data[ix+2];
             uint16_t c = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
-            o[ix2] = c>>8;  // Regrettably we need to store in big-endian form in memory while esp-camera driver remains broken
-            o[ix2+1] = c&0xff;
+            if (Native) {
+                memcpy(o + ix2, &c, sizeof(c));
+            } else {
+                o[ix2] = c>>8;  // Regrettably we need to store in big-endian form in memory while esp-camera driver remains broken
+                o[ix2+1] = c&0xff;
+            }
         }
         data+=w;
     }
     return true;
 }
+// Write the luma of each decoded pixel as one byte, skipping RGB565 altogether
+static bool _grey_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+    jpg_decoder * jpeg = (jpg_decoder *)arg;
+    if(!data){
+        if(x == 0 && y == 0){
+            jpeg->width = w;
+            jpeg->height = h;
+        }
+        return true;
+    }
+    for(uint16_t iy = 0; iy < h; iy++) {
+        uint8_t* o = jpeg->output + (size_t)(y + iy) * jpeg->width + x;
+        for(uint16_t ix = 0; ix < w; ix++, data += 3) {
+            o[ix] = image_kernels::rgbGrey(data[0], data[1], data[2]);
+        }
+    }
+    return true;
+}
+
+// State of a decode of just part of a JPEG
+typedef struct {
+    jpg_decoder jpeg;
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+    image_type_t type;      // RGB565, GRAYSCALE8, RGB888 or BMP (whose header is already in place)
+    size_t stride;          // bytes per output row
+    pixel_order_t order;    // of RGB565 output
+    bool complete;          // The block holding the bottom right pixel of the region has been written
+} jpg_region_decoder_t;
+
+// Keep only the parts of decoded blocks that fall in the region, and stop once it is complete
+static bool _region_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+    jpg_region_decoder_t * region = (jpg_region_decoder_t *)arg;
+    if(!data){
+        if(x == 0 && y == 0){
+            region->jpeg.width = w;
+            region->jpeg.height = h;
+            return region->x + region->width <= w && region->y + region->height <= h;
+        }
+        // Made even when the decode failed part way, so it says nothing about the region
+        return true;
+    }
+    int top = y > region->y ? y : region->y;
+    int bottom = y + h < region->y + region->height ? y + h : region->y + region->height;
+    if (y >= region->y + region->height) {
+        // Blocks arrive row by row so the region has all been written. Abandon the rest of the decode
+        region->complete = true;
+        return false;
+    }
+    int left = x > region->x ? x : region->x;
+    int right = x + w < region->x + region->width ? x + w : region->x + region->width;
+    if (x + w >= region->x + region->width && y + h >= region->y + region->height) {
+        // Blocks arrive in rows, left to right, so the rest of the region came before this one
+        region->complete = true;
+    }
+    if (top >= bottom || left >= right) return true;
+    for (int row = top; row < bottom; row++) {
+        const uint8_t* rgb = data + 3 * ((row - y) * w + (left - x));
+        uint8_t* o = region->jpeg.output + region->jpeg.data_offset + (size_t)(row - region->y) * region->stride;
+        switch (region->type) {
+            case IMAGE_GRAYSCALE8:
+                o += left - region->x;
+                for (int i = 0; i < right - left; i++, rgb += 3) {
+                    o[i] = image_kernels::rgbGrey(rgb[0], rgb[1], rgb[2]);
+                }
+                break;
+            case IMAGE_RGB565:
+                o += 2 * (left - region->x);
+                for (int i = 0; i < right - left; i++, rgb += 3, o += 2) {
+                    uint8_t hi = (rgb[0] & 0xF8) | rgb[1] >> 5;   // Big-endian as in _rgb565_write
+                    uint8_t lo = (rgb[1] & 0x1C) << 3 | rgb[2] >> 3;
+                    o[region->order == PIXEL_ORDER_NATIVE ? 1 : 0] = hi;
+                    o[region->order == PIXEL_ORDER_NATIVE ? 0 : 1] = lo;
+                }
+                break;
+            default:
+                // The decoder gives R G B but RGB888 and BMP are B G R in memory
+                o += 3 * (left - region->x);
+                for (int i = 0; i < right - left; i++, rgb += 3, o += 3) {
+                    o[0] = rgb[2];
+                    o[1] = rgb[1];
+                    o[2] = rgb[0];
+                }
+        }
+    }
+    return true;
+}
+
+// 24 bit BMP header for a top down image (negative height) with padded rows
+static void _bmp_write_header(uint8_t* out, int width, int height) {
+    bmp_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.imagesize = bmpRowStride(width) * height;
+    header.filesize = BMP_HEADER_LEN + header.imagesize;
+    header.fileoffset_to_pixelarray = BMP_HEADER_LEN;
+    header.dibheadersize = 40;
+    header.width = width;
+    header.height = -height;
+    header.planes = 1;
+    header.bitsperpixel = 24;
+    header.ypixelpermeter = 0x0B13;
+    header.xpixelpermeter = 0x0B13;
+    out[0] = bmp_sig[0];
+    out[1] = bmp_sig[1];
+    memcpy(out + 2, &header, sizeof(header));
+}
+
+// Offset of row y of a BMP. Rows run bottom up unless the height in the header is negative
+static size_t _bmp_row_offset(const uint8_t* bmp, int width, int height, int y) {
+    int32_t bmpHeight;
+    uint32_t pixelOffset;
+    memcpy(&bmpHeight, bmp + BMP_HEIGHT_ADDR, sizeof(bmpHeight));
+    memcpy(&pixelOffset, bmp + BMP_OFFSET_ADDR, sizeof(pixelOffset));
+    return pixelOffset + bmpRowStride(width) * (bmpHeight < 0 ? y : height - 1 - y);
+}
+
+static void _bgr_copy(const uint8_t* src, uint8_t* dst, int count) {
+    memcpy(dst, src, 3 * count);
+}
+
+typedef void (*row_kernel_t)(const uint8_t* src, uint8_t* dst, int count);
+
+// Kernel converting a row between two different uncompressed types. RGB888 and BMP rows are both B G R
+static row_kernel_t _row_kernel(image_type_t from, pixel_order_t fromOrder, image_type_t to, pixel_order_t toOrder) {
+    bool bgrSource = from == IMAGE_RGB888 || from == IMAGE_BMP;
+    bool bgrTarget = to == IMAGE_RGB888 || to == IMAGE_BMP;
+    bool nativeSource = fromOrder == PIXEL_ORDER_NATIVE;
+    bool nativeTarget = toOrder == PIXEL_ORDER_NATIVE;
+    if (from == IMAGE_RGB565) {
+        if (bgrTarget) {
+            return nativeSource ? image_kernels::rgb565ToBgrNative : image_kernels::rgb565ToBgr;
+        }
+        return nativeSource ? image_kernels::rgb565ToGreyNative : image_kernels::rgb565ToGrey;
+    }
+    if (from == IMAGE_GRAYSCALE8) {
+        if (bgrTarget) {
+            return image_kernels::greyToBgr;
+        }
+        return nativeTarget ? image_kernels::greyToRgb565Native : image_kernels::greyToRgb565;
+    }
+    if (bgrSource) {
+        if (bgrTarget) {
+            return _bgr_copy;
+        }
+        if (to == IMAGE_RGB565) {
+            return nativeTarget ? image_kernels::bgrToRgb565Native : image_kernels::bgrToRgb565;
+        }
+        return image_kernels::bgrToGrey;
+    }
+    return nullptr;
+}
+
+// State of a compareJpegWith() while the decoder runs
+typedef struct {
+    jpg_decoder jpeg;
+    const uint8_t* reference;
+    uint16_t referenceWidth;
+    uint16_t referenceHeight;
+    bool referenceIsGrey;
+    pixel_order_t referenceOrder;
+    int threshold;
+    const maskFunction* maskFunc;
+    const Mask* mask;
+    int comparedCount;
+    int diffCount;
+} jpg_comparison_t;
+
+// Grey of a decoded pixel exactly as it would be after conversion to RGB565
+static inline uint8_t _rgb565_grey(const uint8_t* rgb) {
+    return image_kernels::rgbGrey(rgb[0] & 0xF8, rgb[1] & 0xFC, rgb[2] & 0xF8);
+}
+
+static inline void _compare_pixels(jpg_comparison_t* cmp, const uint8_t* rgb, const uint8_t* ref, int count) {
+    int diffs = 0;
+    if (cmp->referenceIsGrey) {
+        for (int i = 0; i < count; i++, rgb += 3, ref++) {
+            diffs += abs((int)image_kernels::rgbGrey(rgb[0], rgb[1], rgb[2]) - (int)*ref) > cmp->threshold ? 1 : 0;
+        }
+    } else
+    if (cmp->referenceOrder == PIXEL_ORDER_NATIVE) {
+        const uint16_t* pixel = (const uint16_t*)ref;
+        for (int i = 0; i < count; i++, rgb += 3) {
+            diffs += abs((int)_rgb565_grey(rgb) - (int)image_kernels::rgb565GreyNative(pixel[i])) > cmp->threshold ? 1 : 0;
+        }
+    } else {
+        for (int i = 0; i < count; i++, rgb += 3, ref += 2) {
+            diffs += abs((int)_rgb565_grey(rgb) - (int)image_kernels::rgb565Grey(ref)) > cmp->threshold ? 1 : 0;
+        }
+    }
+    cmp->comparedCount += count;
+    cmp->diffCount += diffs;
+}
+
+// Compare each decoded block with the same area of the reference instead of storing it
+static bool _compare_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+    jpg_comparison_t * cmp = (jpg_comparison_t *)arg;
+    if(!data){
+        if(x == 0 && y == 0){
+            cmp->jpeg.width = w;
+            cmp->jpeg.height = h;
+            // Ask to abandon the decode if the sizes differ, though esp32-camera carries on regardless
+            return w == cmp->referenceWidth && h == cmp->referenceHeight;
+        }
+        return true;
+    }
+    // The JPEG's size fields may be wrong, so only compare the part of the block inside the reference
+    if (x >= cmp->referenceWidth) return true;
+    int cols = x + w > cmp->referenceWidth ? cmp->referenceWidth - x : w;
+    int bytesPerPixel = cmp->referenceIsGrey ? 1 : 2;
+    for(uint16_t iy = 0; iy < h && y + iy < cmp->referenceHeight; iy++, data += 3 * w) {
+        int row = y + iy;
+        const uint8_t* ref = cmp->reference + ((size_t)row * cmp->referenceWidth) * bytesPerPixel;
+        if (cmp->mask) {
+            for (const Mask::Span* span = cmp->mask->rowBegin(row); span != cmp->mask->rowEnd(row); span++) {
+                int start = span->start > x ? span->start : x;
+                int end = span->end < x + cols ? span->end : x + cols;
+                if (start < end) {
+                    _compare_pixels(cmp, data + 3 * (start - x), ref + bytesPerPixel * start, end - start);
+                }
+            }
+        } else
+        if (cmp->maskFunc) {
+            for (int ix = x; ix < x + cols; ix++) {
+                if ((*cmp->maskFunc)(ix, row, cmp->referenceWidth, cmp->referenceHeight)) {
+                    _compare_pixels(cmp, data + 3 * (ix - x), ref + bytesPerPixel * ix, 1);
+                }
+            }
+        } else {
+            _compare_pixels(cmp, data, ref + bytesPerPixel * x, cols);
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    uint8_t* buffer;
+    size_t size;
+    size_t len;
+    size_t limit;       // 0, or the most bytes to write before giving up
+    bool overflowed;    // limit was reached, so the output is incomplete
+} jpg_encoder_out_t;
+
+// Encoder output into a pooled buffer
+static size_t _jpg_pool_write(void * arg, size_t index, const void* data, size_t len) {
+    jpg_encoder_out_t * out = (jpg_encoder_out_t *)arg;
+    // The esp32-camera encoder ignores the 0 and carries on, so every later write has to be refused too
+    if (out->overflowed || (out->limit && index + len > out->limit)) {
+        out->overflowed = true;
+        return 0;
+    }
+    if (index + len > out->size) {
+        size_t grownSize;
+        uint8_t* grown = ImageBufferPool::instance().acquire(2 * (index + len), grownSize);
+        memcpy(grown, out->buffer, out->len);
+        ImageBufferPool::instance().release(out->buffer, out->size);
+        out->buffer = grown;
+        out->size = grownSize;
+    }
+    memcpy(out->buffer + index, data, len);
+    out->len = index + len;
+    return len;
+}
+
 Image::~Image() { 
 	//log_i("In destructor for %s", objectName().c_str());
-    if (buffer != nullptr) delete[] buffer;
+	releaseBuffer();
 	//log_i("done");
 }
+Image& Image::operator=(Image&& that) {
+	if (this != &that) {
+		clear();
+		swap(that);
+	}
+	return *this;
+}
+
+// Exchange content (but not names) in O(1) e.g. to rotate frame history without copying
+void Image::swap(Image& that) {
+	std::swap(type, that.type);
+	std::swap(buffer, that.buffer);
+	std::swap(_ownsBuffer, that._ownsBuffer);
+	std::swap(_bufferSize, that._bufferSize);
+	std::swap(len, that.len);
+	std::swap(width, that.width);
+	std::swap(height, that.height);
+	std::swap(timestamp, that.timestamp);
+	std::swap(_pixelOrder, that._pixelOrder);
+	std::swap(_jpegInfo, that._jpegInfo);
+	std::swap(_jpegInfoParsed, that._jpegInfoParsed);
+	std::swap(_sourceName, that._sourceName);
+	metadata.swap(that.metadata);
+}
+
+// Free the buffer unless it is borrowed from elsewhere by view()
+void Image::releaseBuffer() {
+	if (buffer != nullptr && _ownsBuffer) ImageBufferPool::instance().release(buffer, _bufferSize);
+	buffer = nullptr;
+	_bufferSize = 0;
+	_ownsBuffer = true;
+}
+
+// Get a buffer for the result of a load or conversion
+// This image's own buffer is reused in place if it is of the same size class and is not being read from
+uint8_t* Image::acquireTargetBuffer(size_t targetLen) {
+	bool readingFromBuffer = _sourceBuffer < buffer + _bufferSize && buffer < _sourceBuffer + _sourceLen;
+	if (buffer != nullptr && _ownsBuffer && !readingFromBuffer && _bufferSize >= targetLen
+		&& ImageBufferPool::sizeClass(_bufferSize) == ImageBufferPool::sizeClass(targetLen)) {
+		ImageBufferPool::instance().countReuse();
+		_targetSize = _bufferSize;
+		_targetBuffer = buffer;
+	} else {
+		_targetBuffer = ImageBufferPool::instance().acquire(targetLen, _targetSize);
+	}
+	return _targetBuffer;
+}
+
+// Make the target buffer this image's buffer
+void Image::adoptTargetBuffer() {
+	if (_targetBuffer != buffer) {
+		releaseBuffer();
+	}
+	buffer = _targetBuffer;
+	_bufferSize = _targetSize;
+	_ownsBuffer = true;
+	_targetBuffer = 0;
+	_jpegInfoParsed = false;
+}
+
+// Give up on a target buffer after a failure. If it was this image's own buffer its content is now undefined
+void Image::abandonTargetBuffer() {
+	if (_targetBuffer == buffer) {
+		clear();
+	} else {
+		ImageBufferPool::instance().release(_targetBuffer, _targetSize);
+	}
+	_targetBuffer = 0;
+}
 void Image::setObjectName(String name) {
 	if (name.length() == 0) {
 		char tbuffer[10];
@@ -111,6 +609,11 @@ Image& Image::fromBuffer(uint8_t* extBuffer, size_t width, size_t height, size_t
 	_sourceLen = extLen;
 	_sourceType = imageType;
 	_sourceTimestamp = timestamp;
+	_sourceName = "Buffer";
+	_sourceFilename = "";
+	_sourceMetadataPtr = nullptr;
+	_sourceOrder = PIXEL_ORDER_CAMERA;
+	_sourceJpegInfoParsed = false;
 	_from = true;
 
 	return *this;
@@ -130,11 +633,19 @@ Image& Image::fromCamera(camera_fb_t* frame) {
 	_sourceHeight = frame->height;
 	_sourceTimestamp = frame->timestamp;
 	_sourceName = "Camera";
+	_sourceFilename = "";
 	_sourceMetadataPtr = nullptr;
+	_sourceOrder = PIXEL_ORDER_CAMERA;
+	_sourceJpegInfoParsed = false;
 	switch(frame->format) {
 		case PIXFORMAT_JPEG:
 			_sourceType = IMAGE_JPEG;
-			extractJpegSize(_sourceWidth, _sourceHeight, _sourceBuffer, _sourceLen);
+			if (!_jpg_parse_info(jpg_buffer_reader_t{ _sourceBuffer, _sourceLen }, _sourceLen, _sourceJpegInfo)) {
+				throw LogicError("SOF not found");
+			}
+			_sourceJpegInfoParsed = true;
+			_sourceWidth = _sourceJpegInfo.width;
+			_sourceHeight = _sourceJpegInfo.height;
 			//log_i("Got w = %d, h = %d", _sourceWidth, _sourceHeight);
 			break;
 		case PIXFORMAT_RGB565:
@@ -220,36 +731,45 @@ const uint8_t* Image::nextJpegSegment(const uint8_t* startPtr, const uint8_t* en
 }
 
 void Image::extractJpegSize(uint16_t& width, uint16_t& height, uint8_t* buffer, size_t bufferLen) {
-	const uint8_t* endPtr = buffer + bufferLen - 1;
-	//log_d("%08x -> %08x", buffer, endPtr);
-
-	for (const uint8_t* segmentPtr = buffer; segmentPtr < endPtr - 1; segmentPtr = nextJpegSegment(segmentPtr, endPtr)) {
-		//log_d("SegmentPtr = %08x", segmentPtr);
-		if (segmentPtr == 0) {
-			//log_d("SegmentPtr == 0");
-			break;
-		}
-
-		jpeg_segment_t* segPtr = (jpeg_segment_t*)segmentPtr;
-		if (segPtr->marker == SOF0) {
-			sof0_segment_t* sof0 = (sof0_segment_t*)(segmentPtr + sizeof(jpeg_segment_t));
-			width = bigEndianWord(sof0->imageWidth);
-			height = bigEndianWord(sof0->imageHeight);
-			return;
-		} else {
-			//log_d("Segment = %02x %02x", segmentPtr[0], segmentPtr[1]);
+	JpegInfo info;
+	if (!_jpg_parse_info(jpg_buffer_reader_t{ buffer, bufferLen }, bufferLen, info)) {
+		throw LogicError("SOF not found");
+	}
+	width = info.width;
+	height = info.height;
+}
+const JpegInfo& Image::jpegInfo() {
+	if (!_jpegInfoParsed) {
+		_jpegInfo = JpegInfo();
+		if (type == IMAGE_JPEG) {
+			_jpg_parse_info(jpg_buffer_reader_t{ buffer, len }, len, _jpegInfo);
 		}
+		_jpegInfoParsed = true;
 	}
-	//log_d("Exit");
-	throw LogicError("SOF0 not found");
+	return _jpegInfo;
+}
+JpegInfo Image::probe(FS& fs, const String& path) {
+	JpegInfo info;
+	File file = fs.open(path, FILE_READ);
+	if (file) {
+		std::vector<uint8_t> windowData(JPEG_READ_WINDOW_LEN);
+		jpg_file_window_t window = { &file, 0, 0, windowData.data(), windowData.size() };
+		_jpg_parse_info(jpg_window_reader_t{ &window }, file.size(), info);
+		file.close();
+	}
+	return info;
 }
 // Correct the size of a JPEG image by reading the JPEG metadata
 // This fixes a problem in the esp-camera driver where custom size images
 // requested through sensor->set_res_raw are incorrectly reported in the camera_fb_t buffer
 Image& Image::setTrueSize() {
 	if (type == IMAGE_JPEG) {
-
-		extractJpegSize(width, height, buffer, len);
+		const JpegInfo& info = jpegInfo();
+		if (!info.valid) {
+			throw LogicError("SOF not found");
+		}
+		width = info.width;
+		height = info.height;
 
 		log_i("Corrected (%08x, %d) to %d x %d", &buffer, _sourceLen, width, height);
 	}
@@ -269,7 +789,11 @@ Image& Image::fromImage(Image& sourceImage) {
 	_sourceTimestamp = sourceImage.timestamp;
 	//log_i("sourceImage.objectName() = %s", sourceImage.objectName());
 	_sourceName = sourceImage.objectName();
+	_sourceFilename = "";
 	_sourceMetadataPtr = &sourceImage.metadata;
+	_sourceOrder = sourceImage._pixelOrder;
+	_sourceJpegInfo = sourceImage._jpegInfo;
+	_sourceJpegInfoParsed = sourceImage._jpegInfoParsed;
 	_from = true;
 
 	return *this;
@@ -308,6 +832,9 @@ Image& Image::fromFile(FS& fs, const String& path, image_type_t imageType) {
 	//log_i("_sourceFilename = %s", _sourceFilename);
 	_sourceType = imageType;
 	_sourceFS = &fs;
+	_sourceBuffer = nullptr;
+	_sourceLen = 0;
+	_sourceJpegInfoParsed = false;
 	_from = true;
 	return *this;
 }
@@ -318,6 +845,11 @@ void Image::convertTo(image_type_t newImageType, scaling_type_t scaling) {
 
 	_targetType = newImageType;
 	_scaling = scaling;
+	// A region() or JPEG quality applies to this conversion only
+	image_region_t region = _region;
+	_region.width = 0;
+	jpeg_encoding_t encoding = _encoding;
+	_encoding = { JPEG_DEFAULT_QUALITY, 1, 0 };
 	if (!_from) {
 		_sourceBuffer = buffer;
 		_sourceLen = len;
@@ -325,120 +857,461 @@ void Image::convertTo(image_type_t newImageType, scaling_type_t scaling) {
 		_sourceTimestamp = timestamp;
 		_sourceWidth = width;
 		_sourceHeight = height;
+		_sourceOrder = _pixelOrder;
+		_sourceJpegInfo = _jpegInfo;
+		_sourceJpegInfoParsed = _jpegInfoParsed;
 	}
 	if (_sourceType == _targetType) {
 		throw LogicError(StringF("[%s:%d] %s: Source and target types are the same", __FILE__, __LINE__, objectName().c_str()));
 	}
-	if (_targetType == IMAGE_BMP && _scaling != SCALING_NONE) {
-		throw LogicError(StringF("[%s:%d] %s: Cannot scale when converting to BMP", __FILE__, __LINE__, objectName().c_str()));
+	bool uncompressedSource = _sourceType == IMAGE_RGB565 || _sourceType == IMAGE_RGB888 || _sourceType == IMAGE_GRAYSCALE8 || _sourceType == IMAGE_BMP;
+	bool uncompressedTarget = _targetType == IMAGE_RGB565 || _targetType == IMAGE_RGB888 || _targetType == IMAGE_GRAYSCALE8 || _targetType == IMAGE_BMP;
+	if (region.width > 0 && (_sourceType != IMAGE_JPEG || !uncompressedTarget)) {
+		throw LogicError(StringF("[%s:%d] %s: region() only applies to decoding JPEG, use crop()", __FILE__, __LINE__, objectName().c_str()));
+	}
+	if (_scaling != SCALING_NONE && _sourceType != IMAGE_JPEG) {
+		throw LogicError(StringF("[%s:%d] %s: Cannot scale when converting from %s, use resize()", __FILE__, __LINE__, objectName().c_str(), imageTypeName[_sourceType]));
 	}
-	if (_targetType == IMAGE_JPEG && _scaling != SCALING_NONE) {
-		throw LogicError(StringF("[%s:%d] %s: Cannot scale when converting to JPEG", __FILE__, __LINE__, objectName().c_str()));
+	// A JPEG file is decoded through a small window onto the file instead of being load()ed first
+	bool fromFile = _from && _sourceFilename != "";
+	File sourceFile;
+	std::vector<uint8_t> windowData;
+	jpg_file_window_t window = { &sourceFile, 0, 0, nullptr, 0 };
+	std::map<String, String> fileMetadata;
+	if (fromFile) {
+		if (_sourceType != IMAGE_JPEG || !uncompressedTarget) {
+			throw LogicError(StringF("[%s:%d] %s: Cannot convert file %s to %s, load() it first", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str(), imageTypeName[_targetType]));
+		}
+		if (!_sourceFS->exists(_sourceFilename)) {
+			throw LogicError(StringF("[%s:%d] Missing file %s", __FILE__, __LINE__, _sourceFilename.c_str()));
+		}
+		sourceFile = _sourceFS->open(_sourceFilename, FILE_READ);
+		windowData.resize(JPEG_READ_WINDOW_LEN);
+		window.data = windowData.data();
+		window.size = windowData.size();
+		_sourceBuffer = nullptr;
+		_sourceLen = sourceFile.size();
+		jpg_window_reader_t reader = { &window };
+		if (!_jpg_parse_info(reader, _sourceLen, _sourceJpegInfo)) {
+			throw LogicError(StringF("[%s:%d] %s: %s is not a JPEG", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str()));
+		}
+		_sourceJpegInfoParsed = true;
+		_sourceWidth = _sourceJpegInfo.width;
+		_sourceHeight = _sourceJpegInfo.height;
+		_sourceName = _sourceFilename;
+		_sourceTimestamp.tv_sec = sourceFile.getLastWrite();
+		_sourceTimestamp.tv_usec = 0;
+		size_t metadataOffset, metadataLen;
+		if (_jpg_find_metadata(reader, _sourceJpegInfo, metadataOffset, metadataLen)) {
+			std::vector<char> json(metadataLen);
+			size_t errorAt;
+			if (_jpg_window_read(&window, metadataOffset, (uint8_t*)json.data(), metadataLen) != metadataLen
+				|| !metadata_json::parse(json.data(), json.size(), fileMetadata, errorAt)) {
+				throw LogicError(StringF("[%s:%d] %s: bad metadata JSON in %s", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str()));
+			}
+		} else {
+			loadMetadata(fileMetadata);
+		}
+	}
+	if (_sourceType == IMAGE_JPEG && uncompressedTarget && _sourceJpegInfoParsed && _sourceJpegInfo.progressive()) {
+		throw LogicError(StringF("[%s:%d] %s: %s is a progressive JPEG, which esp_jpg_decode() cannot decode", __FILE__, __LINE__, objectName().c_str(), source().c_str()));
 	}
-	if (_sourceType == IMAGE_JPEG && _targetType == IMAGE_RGB565) {
+	if (_sourceType == IMAGE_JPEG && uncompressedTarget && (region.width > 0 || _targetType == IMAGE_RGB888 || _targetType == IMAGE_BMP)) {
+		// Decode the region (or the whole image) straight into the target layout
+		int scaledWidth = _sourceWidth >> scaling;
+		int scaledHeight = _sourceHeight >> scaling;
+		if (region.width == 0) {
+			region.x = 0;
+			region.y = 0;
+			region.width = scaledWidth;
+			region.height = scaledHeight;
+		}
+		if (region.x + region.width > scaledWidth || region.y + region.height > scaledHeight) {
+			throw LogicError(StringF("[%s:%d] %s: Region %d,%d %d x %d is outside the %d x %d image", __FILE__, __LINE__, objectName().c_str(), region.x, region.y, region.width, region.height, scaledWidth, scaledHeight));
+		}
+		_targetWidth = region.width;
+		_targetHeight = region.height;
+		size_t headerLen = _targetType == IMAGE_BMP ? BMP_HEADER_LEN : 0;
+		size_t stride = _targetType == IMAGE_BMP ? bmpRowStride(_targetWidth) : (size_t)_targetWidth * (_targetType == IMAGE_RGB565 ? 2 : _targetType == IMAGE_RGB888 ? 3 : 1);
+		_targetLen = headerLen + stride * _targetHeight;
+		acquireTargetBuffer(_targetLen);
+		if (_targetType == IMAGE_BMP) {
+			_bmp_write_header(_targetBuffer, _targetWidth, _targetHeight);
+			if (stride != (size_t)_targetWidth * 3) memset(_targetBuffer + headerLen, 0, _targetLen - headerLen);
+		}
+		jpg_region_decoder_t decoder;
+		decoder.jpeg.input = _sourceBuffer;
+		decoder.jpeg.output = _targetBuffer;
+		decoder.jpeg.data_offset = headerLen;
+		decoder.jpeg.width = 0;
+		decoder.jpeg.height = 0;
+		decoder.jpeg.window = fromFile ? &window : nullptr;
+		decoder.x = region.x;
+		decoder.y = region.y;
+		decoder.width = region.width;
+		decoder.height = region.height;
+		decoder.type = _targetType;
+		decoder.stride = stride;
+		decoder.order = _preferredOrder;
+		decoder.complete = false;
+		// jpg_region_decoder_t starts with the jpg_decoder that _jpg_read expects
+		esp_jpg_decode(_sourceLen, (jpg_scale_t)_scaling, _jpg_read, _region_write, (void*)&decoder);
+		_targetTimestamp = _sourceTimestamp;
+		if (scaledWidth != decoder.jpeg.width || scaledHeight != decoder.jpeg.height) {
+			abandonTargetBuffer();
+			throw LogicError(StringF("[%s, %d] %s: expected %d x %d but JPEG decoded as %d x %d", __FILE__, __LINE__, objectName().c_str(), scaledWidth, scaledHeight, decoder.jpeg.width, decoder.jpeg.height));
+		}
+		if (!decoder.complete) {
+			abandonTargetBuffer();
+			throw LogicError(StringF("[%s, %d] %s: JPEG decode stopped before the end of region %d,%d %d x %d", __FILE__, __LINE__, objectName().c_str(), region.x, region.y, region.width, region.height));
+		}
+	} else
+	if (_sourceType == IMAGE_JPEG && (_targetType == IMAGE_RGB565 || _targetType == IMAGE_GRAYSCALE8)) {
 		//log_i("SourceW = %d, SourceH = %d", _sourceWidth, _sourceHeight);
 		_targetWidth = _sourceWidth >> scaling;
 		_targetHeight = _sourceHeight >> scaling;
-		_targetLen = _targetWidth * _targetHeight * 2;
+		_targetLen = _targetWidth * _targetHeight * (_targetType == IMAGE_RGB565 ? 2 : 1);
 		//log_i("Heap: %d/%d PSRAM: %d/%d\n", ESP.getFreeHeap(), ESP.getHeapSize(), ESP.getFreePsram(), ESP.getPsramSize());
-		_targetBuffer = new uint8_t[_targetLen];
+		acquireTargetBuffer(_targetLen);
 		//log_i("Heap: %d/%d PSRAM: %d/%d\n", ESP.getFreeHeap(), ESP.getHeapSize(), ESP.getFreePsram(), ESP.getPsramSize());
 		//log_i("JPG2RGB565 %d %d", _sourceLen, _scaling);
 		jpeg.input = _sourceBuffer;
 		jpeg.output = _targetBuffer;
-		esp_jpg_decode(_sourceLen, (jpg_scale_t)_scaling, _jpg_read, _rgb565_write, (void*)&jpeg);
+		jpeg.data_offset = 0;
+		jpeg.width = 0;
+		jpeg.height = 0;
+		jpeg.window = fromFile ? &window : nullptr;
+		auto writer = _targetType == IMAGE_GRAYSCALE8 ? _grey_write : _preferredOrder == PIXEL_ORDER_NATIVE ? _rgb565_write<true> : _rgb565_write<false>;
+		esp_jpg_decode(_sourceLen, (jpg_scale_t)_scaling, _jpg_read, writer, (void*)&jpeg);
+		_targetTimestamp = _sourceTimestamp;
 		if (_targetWidth != jpeg.width || _targetHeight != jpeg.height) {
+			abandonTargetBuffer();
 			throw LogicError(StringF("[%s, %d] %s: expected %d x %d but JPEG decoded as %d x %d", __FILE__, __LINE__, objectName().c_str(), _targetWidth, _targetHeight, jpeg.width, jpeg.height));
 		}
 	} else 
-	if (_targetType == IMAGE_BMP) {
-		pixformat_t fromType;
-		switch (_sourceType) {
-			case IMAGE_JPEG:
-				fromType = PIXFORMAT_JPEG;
-				break;
-			case IMAGE_RGB565:
-				fromType = PIXFORMAT_RGB565;
-				break;
-			case IMAGE_GRAYSCALE8:
-				fromType = PIXFORMAT_GRAYSCALE;
-				break;
-			default:
-				throw LogicError(StringF("[%s:%d] %s: Cannot convert to BMP from %s", __FILE__, __LINE__, objectName().c_str(), imageTypeName[_sourceType]));
-		}
-
-		//log_i("Running fmt2bmp");
-		if (!fmt2bmp(_sourceBuffer, _sourceLen, _sourceWidth, _sourceHeight, fromType, &_targetBuffer, &_targetLen)) {
-			if (_targetBuffer) delete[] _targetBuffer;
-			_targetBuffer = 0;
-			throw LogicError(StringF("[%s:%d] fmt2bmp failed", __FILE__, __LINE__));
-		} else {
-			log_i("%s: to BMP _targetBuffer = %x (%d) %02x %02x", objectName(), _targetBuffer, _targetLen, _targetBuffer[0], _targetBuffer[1]);
-			_targetWidth = _sourceWidth;
-			_targetHeight = _sourceHeight;
-			_targetTimestamp = _sourceTimestamp;
-		}
+	if (uncompressedSource && uncompressedTarget) {
+		convertPixels();
 	} else
 	if (_targetType == IMAGE_JPEG) {
 		pixformat_t fromPixFormat;
+		uint8_t* pixels = _sourceBuffer;
+		size_t pixelsLen = _sourceLen;
+		std::vector<uint8_t> bgr;  // Only when the source has to be rearranged for the encoder
 		
 		switch (_sourceType) {
 			case IMAGE_RGB888:
+				fromPixFormat = PIXFORMAT_RGB888;
+				break;
 			case IMAGE_BMP:
-				if (_sourceType == IMAGE_BMP) _sourceBuffer += BMP_HEADER_LEN;
-				if (!fmt2jpg(_sourceBuffer, _sourceLen, _sourceWidth, _sourceHeight, PIXFORMAT_RGB888, 12, &_targetBuffer, &_targetLen)) {
-					if (_targetBuffer) delete[] _targetBuffer;
-					_targetBuffer = 0;
-					throw LogicError(StringF("[%s:%d] fmt2bmp failed", __FILE__, __LINE__));
+				fromPixFormat = PIXFORMAT_RGB888;
+				pixelsLen = (size_t)_sourceWidth * _sourceHeight * 3;
+				if (_sourceHeight < 2 || _bmp_row_offset(_sourceBuffer, _sourceWidth, _sourceHeight, 1) == _bmp_row_offset(_sourceBuffer, _sourceWidth, _sourceHeight, 0) + 3 * _sourceWidth) {
+					pixels += _bmp_row_offset(_sourceBuffer, _sourceWidth, _sourceHeight, 0);
+				} else {
+					// Padded or bottom up rows have to be gathered for the encoder
+					bgr.resize(pixelsLen);
+					for (int y = 0; y < _sourceHeight; y++) {
+						memcpy(bgr.data() + (size_t)y * _sourceWidth * 3, _sourceBuffer + _bmp_row_offset(_sourceBuffer, _sourceWidth, _sourceHeight, y), _sourceWidth * 3);
+					}
+					pixels = bgr.data();
 				}
-				_targetWidth = _sourceWidth;
-				_targetHeight = _sourceHeight;
-				_targetTimestamp = _sourceTimestamp;
 				break;
 			case IMAGE_RGB565:
-				if (!fmt2jpg(_sourceBuffer, _sourceLen, _sourceWidth, _sourceHeight, PIXFORMAT_RGB565, 12, &_targetBuffer, &_targetLen)) {
-					if (_targetBuffer) delete[] _targetBuffer;
-					_targetBuffer = 0;
-					throw LogicError(StringF("[%s:%d] fmt2bmp failed", __FILE__, __LINE__));
+				fromPixFormat = PIXFORMAT_RGB565;
+				if (_sourceOrder == PIXEL_ORDER_NATIVE) {
+					// The encoder takes the camera's order
+					bgr.resize(_sourceLen);
+					image_kernels::swapRgb565(_sourceBuffer, bgr.data(), _sourceLen / 2);
+					pixels = bgr.data();
 				}
-//				log_i("Written to %08x (%d)", _targetBuffer, _targetLen);
-				_targetWidth = _sourceWidth;
-				_targetHeight = _sourceHeight;
-				_targetTimestamp = _sourceTimestamp;
 				break;
 			case IMAGE_GRAYSCALE8:
-				if (!fmt2jpg(_sourceBuffer, _sourceLen, _sourceWidth, _sourceHeight, PIXFORMAT_GRAYSCALE, 12, &_targetBuffer, &_targetLen)) {
-					if (_targetBuffer) delete[] _targetBuffer;
-					_targetBuffer = 0;
-					throw LogicError(StringF("[%s:%d] fmt2bmp failed", __FILE__, __LINE__));
-				}
-				_targetWidth = _sourceWidth;
-				_targetHeight = _sourceHeight;
-				_targetTimestamp = _sourceTimestamp;
+				fromPixFormat = PIXFORMAT_GRAYSCALE;
 				break;
 			default:
 				throw LogicError(StringF("[%s:%d] %s: Cannot convert to JPEG from %s", __FILE__, __LINE__, objectName().c_str(), imageTypeName[_sourceType]));
 		}
+		// Encode straight into a pooled buffer, growing it if the first guess at the size is too small.
+		// With a target size every attempt reuses the one buffer, which never needs to be larger than the target
+		jpg_encoder_out_t out = { nullptr, 0, 0, encoding.targetLen, false };
+		out.buffer = ImageBufferPool::instance().acquire(encoding.targetLen ? encoding.targetLen : _sourceWidth * _sourceHeight / 2 + 1024, out.size);
+		auto encode = [&](int quality) -> bool {
+			out.len = 0;
+			out.overflowed = false;
+			// Whether it fits is up to the writer, as fmt2jpg_cb() succeeds even when writes were refused
+			bool ok = fmt2jpg_cb(pixels, pixelsLen, _sourceWidth, _sourceHeight, fromPixFormat, quality, _jpg_pool_write, (void*)&out);
+			if (out.overflowed) return false;
+			if (ok) return true;
+			ImageBufferPool::instance().release(out.buffer, out.size);
+			throw LogicError(StringF("[%s:%d] fmt2jpg failed", __FILE__, __LINE__));
+		};
+		if (!encoding.targetLen) {
+			encode(encoding.quality);
+		} else
+		if (!encode(encoding.quality)) {
+			// Bisect for the highest quality that fits. The buffer holds the last attempt, which may not be the best
+			int low = encoding.minQuality;
+			int high = encoding.quality - 1;
+			int best = 0;
+			int last = 0;
+			while (low <= high) {
+				last = (low + high) / 2;
+				if (encode(last)) {
+					best = last;
+					low = last + 1;
+				} else {
+					high = last - 1;
+				}
+			}
+			if (!best) {
+				// Nothing fits, so settle for the smallest
+				best = encoding.minQuality;
+				out.limit = 0;
+			}
+			if (last != best || !out.limit) {
+				encode(best);
+			}
+			//log_i("%s: JPEG quality %d is %d bytes", objectName().c_str(), best, out.len);
+		}
+//		log_i("Written to %08x (%d)", out.buffer, out.len);
+		_targetBuffer = out.buffer;
+		_targetSize = out.size;
+		_targetLen = out.len;
+		_targetWidth = _sourceWidth;
+		_targetHeight = _sourceHeight;
+		_targetTimestamp = _sourceTimestamp;
+	} else {
+		throw LogicError(StringF("[%s:%d] %s: Cannot convert from %s to %s", __FILE__, __LINE__, objectName().c_str(), imageTypeName[_sourceType], imageTypeName[_targetType]));
 	}
 	//log_i("%s: Buffer is %08x", objectName().c_str(), buffer);
 	//log_i("Heap: %d/%d PSRAM: %d/%d", ESP.getFreeHeap(), ESP.getHeapSize(), ESP.getFreePsram(), ESP.getPsramSize());	
-	if (buffer != nullptr) delete[] buffer;
 	//log_i("Heap: %d/%d PSRAM: %d/%d", ESP.getFreeHeap(), ESP.getHeapSize(), ESP.getFreePsram(), ESP.getPsramSize());	
 	//log_i("%s: Setting buffer to %08x", objectName().c_str(), _targetBuffer);
-	buffer = _targetBuffer;
-	_targetBuffer = 0;
+	adoptTargetBuffer();
 	//log_i("Heap: %d/%d PSRAM: %d/%d", ESP.getFreeHeap(), ESP.getHeapSize(), ESP.getFreePsram(), ESP.getPsramSize());	
 	len = _targetLen;
 	type = _targetType;
 	width = _targetWidth;
 	height = _targetHeight;
 	timestamp = _targetTimestamp;
+	_pixelOrder = _preferredOrder;
+	_from = false;
+	if (fromFile) {
+		metadata = fileMetadata;
+	}
 	log_i("%s: converted to %s (%d x %d) from %s", objectName().c_str(), typeName(), width, height, source().c_str());
 	//log_i("Heap: %d/%d PSRAM: %d/%d", ESP.getFreeHeap(), ESP.getHeapSize(), ESP.getFreePsram(), ESP.getPsramSize());	
 	//log_i("Returning");
 	return;
 }
 
+// Uncompressed to uncompressed, one row kernel call per row straight from the source to the target.
+// RGB888 and BMP pixels are both B G R so between them only the header, padding and row order change
+void Image::convertPixels() {
+	row_kernel_t rowKernel = _row_kernel(_sourceType, _sourceOrder, _targetType, _preferredOrder);
+	bool bgrSource = _sourceType == IMAGE_RGB888 || _sourceType == IMAGE_BMP;
+	bool bgrTarget = _targetType == IMAGE_RGB888 || _targetType == IMAGE_BMP;
+	int sourceBytes = _sourceType == IMAGE_RGB565 ? 2 : bgrSource ? 3 : 1;
+	int targetBytes = _targetType == IMAGE_RGB565 ? 2 : bgrTarget ? 3 : 1;
+	size_t sourceStride = (size_t)_sourceWidth * sourceBytes;
+	if (_sourceType != IMAGE_BMP && _sourceLen < sourceStride * _sourceHeight) {
+		throw LogicError(StringF("[%s:%d] %s: %d bytes is too small for a %d x %d %s image", __FILE__, __LINE__, objectName().c_str(), _sourceLen, _sourceWidth, _sourceHeight, imageTypeName[_sourceType]));
+	}
+	_targetWidth = _sourceWidth;
+	_targetHeight = _sourceHeight;
+	size_t headerLen = _targetType == IMAGE_BMP ? BMP_HEADER_LEN : 0;
+	size_t targetStride = _targetType == IMAGE_BMP ? bmpRowStride(_targetWidth) : (size_t)_targetWidth * targetBytes;
+	size_t padding = targetStride - (size_t)_targetWidth * targetBytes;
+	_targetLen = headerLen + targetStride * _targetHeight;
+	_targetTimestamp = _sourceTimestamp;
+	acquireTargetBuffer(_targetLen);
+	if (_targetType == IMAGE_BMP) {
+		_bmp_write_header(_targetBuffer, _targetWidth, _targetHeight);
+	}
+	for (int y = 0; y < _targetHeight; y++) {
+		const uint8_t* sourceRow = _sourceBuffer + (_sourceType == IMAGE_BMP ? _bmp_row_offset(_sourceBuffer, _sourceWidth, _sourceHeight, y) : y * sourceStride);
+		uint8_t* targetRow = _targetBuffer + headerLen + y * targetStride;
+		rowKernel(sourceRow, targetRow, _targetWidth);
+		if (padding) memset(targetRow + targetStride - padding, 0, padding);
+	}
+}
+
+void Image::resize(int newWidth, int newHeight, resize_method_t method) {
+	if (!_from) {
+		_sourceBuffer = buffer;
+		_sourceLen = len;
+		_sourceType = type;
+		_sourceTimestamp = timestamp;
+		_sourceWidth = width;
+		_sourceHeight = height;
+		_sourceOrder = _pixelOrder;
+	}
+	if (_from && _sourceFilename != "") {
+		throw LogicError(StringF("[%s:%d] %s: Cannot resize file %s, load() it first", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str()));
+	}
+	if (_sourceType != IMAGE_RGB565 && _sourceType != IMAGE_RGB888 && _sourceType != IMAGE_GRAYSCALE8) {
+		throw LogicError(StringF("[%s:%d] %s: Cannot resize %s", __FILE__, __LINE__, objectName().c_str(), imageTypeName[_sourceType]));
+	}
+	if (newWidth <= 0 || newWidth > 0xFFFF || newHeight <= 0 || newHeight > 0xFFFF || _sourceWidth == 0 || _sourceHeight == 0) {
+		throw LogicError(StringF("[%s:%d] %s: Cannot resize %d x %d to %d x %d", __FILE__, __LINE__, objectName().c_str(), _sourceWidth, _sourceHeight, newWidth, newHeight));
+	}
+	int pixelBytes = _sourceType == IMAGE_RGB565 ? 2 : _sourceType == IMAGE_RGB888 ? 3 : 1;
+	size_t sourceStride = (size_t)_sourceWidth * pixelBytes;
+	size_t targetStride = (size_t)newWidth * pixelBytes;
+	_targetType = _sourceType;
+	_targetWidth = newWidth;
+	_targetHeight = newHeight;
+	_targetLen = targetStride * newHeight;
+	_targetTimestamp = _sourceTimestamp;
+	acquireTargetBuffer(_targetLen);
+
+	image_kernels::ResizeTaps columns(_sourceWidth, newWidth, method);
+	image_kernels::ResizeTaps rows(_sourceHeight, newHeight, method);
+	bool nativeSource = _sourceOrder == PIXEL_ORDER_NATIVE;
+	bool nativeTarget = _preferredOrder == PIXEL_ORDER_NATIVE;
+	if (method == RESIZE_NEAREST) {
+		bool swapOrder = _sourceType == IMAGE_RGB565 && nativeSource != nativeTarget;
+		for (int y = 0; y < newHeight; y++) {
+			uint8_t* targetRow = _targetBuffer + y * targetStride;
+			image_kernels::resampleRowNearest(_sourceBuffer + rows.first[y] * sourceStride, targetRow, columns, pixelBytes);
+			if (swapOrder) image_kernels::swapRgb565(targetRow, targetRow, newWidth);
+		}
+	} else {
+		// RGB565 is resampled as 8 bit B, G, R and packed again afterwards
+		int channels = _sourceType == IMAGE_GRAYSCALE8 ? 1 : 3;
+		int rowValues = newWidth * channels;
+		std::vector<uint8_t> unpacked(_sourceType == IMAGE_RGB565 ? _sourceWidth * 3 : 0);
+		std::vector<uint8_t> blended(_sourceType == IMAGE_RGB565 ? rowValues : 0);
+		auto unpack = nativeSource ? image_kernels::rgb565ToBgrNative : image_kernels::rgb565ToBgr;
+		auto pack = nativeTarget ? image_kernels::bgrToRgb565Native : image_kernels::bgrToRgb565;
+		// Horizontally resampled input rows, kept while later output rows still need them
+		int slots = rows.maxTaps + 1;
+		std::vector<uint16_t> resampled((size_t)slots * rowValues);
+		std::vector<int> resampledRow(slots, -1);
+		std::vector<const uint16_t*> taps(rows.maxTaps);
+		for (int y = 0; y < newHeight; y++) {
+			for (int t = 0; t < rows.count[y]; t++) {
+				int sourceY = rows.first[y] + t;
+				int slot = sourceY % slots;
+				uint16_t* row = resampled.data() + (size_t)slot * rowValues;
+				if (resampledRow[slot] != sourceY) {
+					const uint8_t* sourceRow = _sourceBuffer + sourceY * sourceStride;
+					if (_sourceType == IMAGE_RGB565) {
+						unpack(sourceRow, unpacked.data(), _sourceWidth);
+						sourceRow = unpacked.data();
+					}
+					image_kernels::resampleRow(sourceRow, row, columns, channels);
+					resampledRow[slot] = sourceY;
+				}
+				taps[t] = row;
+			}
+			uint8_t* targetRow = _targetBuffer + y * targetStride;
+			const uint16_t* weights = rows.weights.data() + rows.offset[y];
+			if (_sourceType == IMAGE_RGB565) {
+				image_kernels::blendRows(taps.data(), weights, rows.count[y], blended.data(), rowValues);
+				pack(blended.data(), targetRow, newWidth);
+			} else {
+				image_kernels::blendRows(taps.data(), weights, rows.count[y], targetRow, rowValues);
+			}
+		}
+	}
+	adoptTargetBuffer();
+	len = _targetLen;
+	type = _targetType;
+	width = _targetWidth;
+	height = _targetHeight;
+	timestamp = _targetTimestamp;
+	_pixelOrder = _preferredOrder;
+	_from = false;
+	log_i("%s: resized to %d x %d from %s", objectName().c_str(), width, height, source().c_str());
+}
+
+void Image::convertTo(image_type_t newImageType, int quality) {
+	if (newImageType != IMAGE_JPEG || quality < 1 || quality > 100) {
+		throw LogicError(StringF("[%s:%d] %s: Cannot convert to %s at quality %d, only JPEG from 1 to 100", __FILE__, __LINE__, objectName().c_str(), imageTypeName[newImageType], quality));
+	}
+	_encoding = { (uint8_t)quality, 1, 0 };
+	convertTo(newImageType, SCALING_NONE);
+}
+
+void Image::convertTo(image_type_t newImageType, size_t targetLen, int minQuality, int maxQuality) {
+	if (newImageType != IMAGE_JPEG || targetLen == 0 || minQuality < 1 || minQuality > maxQuality || maxQuality > 100) {
+		throw LogicError(StringF("[%s:%d] %s: Cannot convert to %s of %d bytes at quality %d to %d, only JPEG from 1 to 100", __FILE__, __LINE__, objectName().c_str(), imageTypeName[newImageType], (int)targetLen, minQuality, maxQuality));
+	}
+	_encoding = { (uint8_t)maxQuality, (uint8_t)minQuality, targetLen };
+	convertTo(newImageType, SCALING_NONE);
+}
+
+Image& Image::region(int x, int y, int regionWidth, int regionHeight) {
+	if (x < 0 || y < 0 || regionWidth <= 0 || regionHeight <= 0 || x + regionWidth > 0xFFFF || y + regionHeight > 0xFFFF) {
+		throw LogicError(StringF("[%s:%d] %s: Region %d,%d %d x %d is invalid", __FILE__, __LINE__, objectName().c_str(), x, y, regionWidth, regionHeight));
+	}
+	_region.x = x;
+	_region.y = y;
+	_region.width = regionWidth;
+	_region.height = regionHeight;
+	return *this;
+}
+
+// Copy a rectangle of the source (or this image) row by row
+void Image::crop(int x, int y, int cropWidth, int cropHeight) {
+	bool inPlace = !_from;
+	if (!_from) {
+		_sourceBuffer = buffer;
+		_sourceLen = len;
+		_sourceType = type;
+		_sourceTimestamp = timestamp;
+		_sourceWidth = width;
+		_sourceHeight = height;
+		_sourceOrder = _pixelOrder;
+	}
+	if (_from && _sourceFilename != "") {
+		throw LogicError(StringF("[%s:%d] %s: Cannot crop file %s, load() it first", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str()));
+	}
+	if (_sourceType != IMAGE_RGB565 && _sourceType != IMAGE_RGB888 && _sourceType != IMAGE_GRAYSCALE8) {
+		throw LogicError(StringF("[%s:%d] %s: Cannot crop %s%s", __FILE__, __LINE__, objectName().c_str(), imageTypeName[_sourceType], _sourceType == IMAGE_JPEG ? ", use region() then convertTo()" : ""));
+	}
+	if (x < 0 || y < 0 || cropWidth <= 0 || cropHeight <= 0 || x + cropWidth > _sourceWidth || y + cropHeight > _sourceHeight) {
+		throw LogicError(StringF("[%s:%d] %s: Region %d,%d %d x %d is outside the %d x %d image", __FILE__, __LINE__, objectName().c_str(), x, y, cropWidth, cropHeight, _sourceWidth, _sourceHeight));
+	}
+	int pixelBytes = _sourceType == IMAGE_RGB565 ? 2 : _sourceType == IMAGE_RGB888 ? 3 : 1;
+	size_t sourceStride = (size_t)_sourceWidth * pixelBytes;
+	size_t targetStride = (size_t)cropWidth * pixelBytes;
+	_targetType = _sourceType;
+	_targetWidth = cropWidth;
+	_targetHeight = cropHeight;
+	_targetLen = targetStride * cropHeight;
+	_targetTimestamp = _sourceTimestamp;
+	const uint8_t* from = _sourceBuffer + y * sourceStride + x * pixelBytes;
+	bool swapOrder = _sourceType == IMAGE_RGB565 && _sourceOrder != _preferredOrder;
+	if (inPlace && _ownsBuffer) {
+		// Each row moves to an earlier (or the same) position so the buffer can be compacted where it is
+		_targetBuffer = buffer;
+		_targetSize = _bufferSize;
+		for (int row = 0; row < cropHeight; row++) {
+			memmove(_targetBuffer + row * targetStride, from + row * sourceStride, targetStride);
+			if (swapOrder) image_kernels::swapRgb565(_targetBuffer + row * targetStride, _targetBuffer + row * targetStride, cropWidth);
+		}
+	} else {
+		acquireTargetBuffer(_targetLen);
+		for (int row = 0; row < cropHeight; row++) {
+			if (swapOrder) {
+				image_kernels::swapRgb565(from + row * sourceStride, _targetBuffer + row * targetStride, cropWidth);
+			} else {
+				memcpy(_targetBuffer + row * targetStride, from + row * sourceStride, targetStride);
+			}
+		}
+	}
+	adoptTargetBuffer();
+	_pixelOrder = _preferredOrder;
+	len = _targetLen;
+	type = _targetType;
+	width = _targetWidth;
+	height = _targetHeight;
+	timestamp = _targetTimestamp;
+	_from = false;
+}
+
 // Just load an image from a source without any conversion or scaling
 void Image::load(missing_image_file_on_load_t missing_file_option) {
 	if (! _from) {
@@ -450,8 +1323,13 @@ void Image::load(missing_image_file_on_load_t missing_file_option) {
 
 	if (_sourceFilename == "") {
 		_targetLen = _sourceLen;
-		_targetBuffer = new uint8_t[_targetLen];
-		memcpy(_targetBuffer, _sourceBuffer, _sourceLen);
+		acquireTargetBuffer(_targetLen);
+		if (_sourceType == IMAGE_RGB565 && _sourceOrder != _preferredOrder) {
+			// Change the order once here rather than on every access
+			image_kernels::swapRgb565(_sourceBuffer, _targetBuffer, _sourceLen / 2);
+		} else {
+			memcpy(_targetBuffer, _sourceBuffer, _sourceLen);
+		}
 		_targetWidth = _sourceWidth;
 		_targetHeight = _sourceHeight;
 		_targetType = _sourceType;
@@ -475,11 +1353,10 @@ void Image::load(missing_image_file_on_load_t missing_file_option) {
 		
 		size_t fileSize = file.size();
 		//log_i("File size of %s = %d", _sourceFilename, fileSize);
-		_targetBuffer = new uint8_t[fileSize];
+		acquireTargetBuffer(fileSize);
 		bytesRead = file.readBytes((char*)_targetBuffer, fileSize);
 		if (bytesRead != fileSize) {
-			delete[] _targetBuffer;
-			_targetBuffer = 0;
+			abandonTargetBuffer();
 			throw RuntimeError(StringF("[%s:%d] Incomplete file read from %s", __FILE__, __LINE__, _sourceFilename.c_str()));
 		}
 		_sourceName = _sourceFilename;
@@ -490,71 +1367,68 @@ void Image::load(missing_image_file_on_load_t missing_file_option) {
 		switch(_targetType) {
 			case IMAGE_JPEG:
 				if (! (_targetBuffer[0] == jpg_sig[0] && _targetBuffer[1] == jpg_sig[1])) {
-					delete[] _targetBuffer;
-					_targetBuffer = 0;
+					abandonTargetBuffer();
 					throw LogicError(StringF("[%s:%d] %s: contents of %s are not %s", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str(), imageTypeName[_targetType]));	
 				}
 				// A JPG image read from a file contains the width x height in metadata but this must be recovered by decoding
-				extractJpegSize(_targetWidth, _targetHeight, _targetBuffer, _targetLen);
+				if (!_jpg_parse_info(jpg_buffer_reader_t{ _targetBuffer, _targetLen }, _targetLen, _sourceJpegInfo)) {
+					abandonTargetBuffer();
+					throw LogicError(StringF("[%s:%d] %s: no SOF segment in %s", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str()));
+				}
+				_sourceJpegInfoParsed = true;
+				_targetWidth = _sourceJpegInfo.width;
+				_targetHeight = _sourceJpegInfo.height;
 				_targetTimestamp.tv_sec = file.getLastWrite();
 				_targetTimestamp.tv_usec = 0;
 				break;
 			case IMAGE_BMP:
 				if (! (_targetBuffer[0] == bmp_sig[0] && _targetBuffer[1] == bmp_sig[1])) {
 					//log_i("sig[0] = %02x sig[1] = %02x", _targetBuffer[0], _targetBuffer[1]);
-					delete[] _targetBuffer;
-					_targetBuffer = 0;
+					abandonTargetBuffer();
 					throw LogicError(StringF("[%s:%d] %s: contents of %s are not %s", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str(), imageTypeName[_targetType]));	
 				}
-				_targetWidth = *(uint32_t*)(_targetBuffer + BMP_WIDTH_ADDR);
-				_targetHeight = *(uint32_t*)(_targetBuffer + BMP_HEIGHT_ADDR);
+				{
+					// The height is negative when the rows run top down, as they do in the BMPs written here
+					bmp_header_t header;
+					memcpy(&header, _targetBuffer + 2, sizeof(header));
+					_targetWidth = header.width;
+					_targetHeight = header.height < 0 ? -header.height : header.height;
+					if (header.bitsperpixel != 24 || header.compression != 0 || header.width <= 0
+						|| _targetLen < header.fileoffset_to_pixelarray + bmpRowStride(_targetWidth) * _targetHeight) {
+						abandonTargetBuffer();
+						throw LogicError(StringF("[%s:%d] %s: %s is not an uncompressed 24 bit BMP", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str()));
+					}
+				}
 				_targetTimestamp.tv_sec = file.getLastWrite();
 				_targetTimestamp.tv_usec = 0;
 				break;
 			default:
-				delete[] _targetBuffer;
-				_targetBuffer = 0;
+				abandonTargetBuffer();
 				throw LogicError(StringF("[%s:%d] %s: cannot load %s", __FILE__, __LINE__, objectName().c_str(), imageTypeName[_targetType]));
 		}
-		// Load any image metadata from FS too
-		String metadataFilename = _sourceFilename.substring(0, _sourceFilename.indexOf(".")) + ".json";
-
-		if (_sourceFS->exists(metadataFilename)) {
-			tempMetadata.clear();
-			auto file = _sourceFS->open(metadataFilename, FILE_READ);
-			String startOfFile = readFileToChar(file, '{');
-			if (startOfFile.indexOf('{') == -1) 
-				throw LogicError(StringF("%s does not contain {", metadataFilename.c_str()));
-			while(file.available()) {
-				String startOfLine = readFileToChar(file, '{');
-				if (startOfLine.indexOf('{') == -1) 
-					break;
-				String labelValuePair = readFileToChar(file, '}');
-				//log_d("labelValuePair = %s", labelValuePair.c_str());
-				if (! labelValuePair.endsWith("}"))
-					throw LogicError("%s: JSON line should end with }");
-
-				auto fields = split(labelValuePair, '"');
-				if (fields.size() != 9)
-					throw LogicError(StringF("%s: bad line %s", metadataFilename.c_str(), labelValuePair.c_str()));
-				tempMetadata[fields[3]] = fields[7];
-			}
-			file.close();
-		}
-		
 	} // Finished reading from _sourceFS
 
 	// Replace previous image content if any
 	//log_i("%s: Buffer is %08x", objectName(), buffer);
-	if (buffer) delete[] buffer;
 	//log_i("%s: Setting buffer to %08x", objectName(), _targetBuffer);
-	buffer = _targetBuffer;
-	_targetBuffer = 0;
+	adoptTargetBuffer();
 	len = _targetLen;
 	width = _targetWidth;
 	height = _targetHeight;
 	type = _targetType;
 	timestamp = _targetTimestamp;
+	_pixelOrder = _preferredOrder;
+	// The content is a copy so what was found in the source headers still applies
+	_jpegInfo = _sourceJpegInfo;
+	_jpegInfoParsed = _sourceJpegInfoParsed;
+	_from = false;
+	if (_targetMetadataPtr == &tempMetadata) {
+		// Metadata embedded in a JPEG takes the place of a sidecar file. Either is read once the buffer
+		// has been adopted, so that a bad one cannot leak it
+		if (type != IMAGE_JPEG || !extractJpegMetadata(tempMetadata)) {
+			loadMetadata(tempMetadata);
+		}
+	}
 	if (_targetMetadataPtr != nullptr) {
 		metadata = *_targetMetadataPtr;  // Copy the metadata collection
 	}
@@ -565,6 +1439,160 @@ void Image::load(missing_image_file_on_load_t missing_file_option) {
  	return;
 }
 
+// Parse the metadata in the APP9 segment of this JPEG, if it has one
+bool Image::extractJpegMetadata(std::map<String, String>& fileMetadata) {
+	size_t jsonOffset, jsonLen;
+	if (!_jpg_find_metadata(jpg_buffer_reader_t{ buffer, len }, jpegInfo(), jsonOffset, jsonLen)) {
+		return false;
+	}
+	if (jsonOffset + jsonLen > len) {
+		throw LogicError(StringF("[%s:%d] %s: metadata runs past the end of %s", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str()));
+	}
+	size_t errorAt;
+	fileMetadata.clear();
+	if (!metadata_json::parse((const char*)buffer + jsonOffset, jsonLen, fileMetadata, errorAt)) {
+		throw LogicError(StringF("[%s:%d] %s: bad metadata JSON in %s at offset %d", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str(), (int)errorAt));
+	}
+	return true;
+}
+
+// Read the metadata sidecar of the source file, if it has one
+void Image::loadMetadata(std::map<String, String>& fileMetadata) {
+	String metadataFilename = _sourceFilename.substring(0, _sourceFilename.indexOf(".")) + ".json";
+
+	if (_sourceFS->exists(metadataFilename)) {
+		fileMetadata.clear();
+		// Sidecars are small so read it in one go and parse it from memory
+		auto file = _sourceFS->open(metadataFilename, FILE_READ);
+		std::vector<char> json(file.size());
+		if (file.read((uint8_t*)json.data(), json.size()) != json.size()) {
+			throw RuntimeError(StringF("[%s:%d] Incomplete file read from %s", __FILE__, __LINE__, metadataFilename.c_str()));
+		}
+		file.close();
+		size_t errorAt;
+		if (!metadata_json::parse(json.data(), json.size(), fileMetadata, errorAt)) {
+			throw LogicError(StringF("[%s:%d] %s: bad metadata JSON at offset %d", __FILE__, __LINE__, metadataFilename.c_str(), (int)errorAt));
+		}
+	}
+}
+
+// Reference a buffer, camera or Image source in place without copying it
+void Image::view() {
+	if (! _from) {
+		throw LogicError(StringF("[%s:%d] Missing fromXXX() clause", __FILE__, __LINE__));
+	}
+	if (_sourceFilename != "") {
+		throw LogicError(StringF("[%s:%d] %s: Cannot view file %s, use load()", __FILE__, __LINE__, objectName().c_str(), _sourceFilename.c_str()));
+	}
+	if (_sourceBuffer == buffer) {
+		throw LogicError(StringF("[%s:%d] %s: Cannot view itself", __FILE__, __LINE__, objectName().c_str()));
+	}
+	releaseBuffer();
+	buffer = _sourceBuffer;
+	_ownsBuffer = false;
+	len = _sourceLen;
+	width = _sourceWidth;
+	height = _sourceHeight;
+	type = _sourceType;
+	timestamp = _sourceTimestamp;
+	_pixelOrder = _sourceOrder;
+	_jpegInfo = _sourceJpegInfo;
+	_jpegInfoParsed = _sourceJpegInfoParsed;
+	if (_sourceMetadataPtr != nullptr) {
+		metadata = *_sourceMetadataPtr;  // Copy the metadata collection
+	}
+	if (width == 0 || height == 0) {
+		throw LogicError(StringF("%s dimensions were %d x %d", _sourceName.c_str(), width, height));
+	}
+	_from = false;
+	log_i("%s: viewing %s (%d x %d) from %s", objectName().c_str(), typeName(), width, height, source().c_str());
+}
+
+// Replace a borrowed buffer with a private copy so the source can be released
+void Image::detach() {
+	if (! isView()) {
+		return;
+	}
+	uint8_t* copy = ImageBufferPool::instance().acquire(len, _bufferSize);
+	memcpy(copy, buffer, len);
+	buffer = copy;
+	_ownsBuffer = true;
+}
+
+// Write an uncompressed image as a BMP a block of rows at a time, so no BMP copy of the image is made
+void Image::writeBmp(File& file) {
+	size_t stride = bmpRowStride(width);
+	size_t padding = stride - (size_t)width * 3;
+	row_kernel_t rowKernel = _row_kernel(type, _pixelOrder, IMAGE_BMP, PIXEL_ORDER_CAMERA);
+	// As many rows as fit in BMP_WRITE_BUFFER_LEN, and at least one
+	int rowsPerWrite = stride >= BMP_WRITE_BUFFER_LEN ? 1 : BMP_WRITE_BUFFER_LEN / stride;
+	std::vector<uint8_t> block(BMP_HEADER_LEN > stride * rowsPerWrite ? BMP_HEADER_LEN : stride * rowsPerWrite);
+	_bmp_write_header(block.data(), width, height);
+	bool written = file.write(block.data(), BMP_HEADER_LEN) == BMP_HEADER_LEN;
+	for (int y = 0; written && y < height; y += rowsPerWrite) {
+		int rows = y + rowsPerWrite > height ? height - y : rowsPerWrite;
+		for (int i = 0; i < rows; i++) {
+			uint8_t* row = block.data() + i * stride;
+			rowKernel(rowPointer(y + i), row, width);
+			if (padding) memset(row + stride - padding, 0, padding);
+		}
+		written = file.write(block.data(), rows * stride) == rows * stride;
+	}
+	if (!written) {
+		log_e("File write failed %s", _targetFilename.c_str());
+		throw RuntimeError(StringF("[%s:%d] %s:Incomplete file write to %s", __FILE__, __LINE__, objectName().c_str(), _targetFilename.c_str()));
+	}
+}
+
+// Write this JPEG with its metadata in an APP9 segment after any APP0 (JFIF) and APP1 (EXIF) segments,
+// leaving out any APP9 segment it was loaded with. Returns false if there is no metadata or it is too long
+// for a segment, so it was not embedded
+bool Image::writeJpegMetadata(File& file) {
+	String json;
+	size_t segmentLen = 0;
+	if (metadata.size() > 0) {
+		metadata_json::write(metadata, json);
+		segmentLen = 2 + JPEG_METADATA_ID_LEN + json.length();
+		if (segmentLen > 0xFFFF) {
+			log_w("%s: %d bytes of metadata is too long for a JPEG segment, using a sidecar", objectName().c_str(), json.length());
+			segmentLen = 0;
+		}
+	}
+	const uint8_t* endPtr = buffer + len;
+	const uint8_t* insertPtr = buffer + 2;
+	const uint8_t* oldPtr = endPtr;
+	size_t oldLen = 0;
+	const JpegInfo& info = jpegInfo();
+	size_t jsonOffset, jsonLen;
+	for (int i = 0; i < info.appCount; i++) {
+		const jpeg_app_segment_t& app = info.app[i];
+		if (app.offset + app.length > len) {
+			break;
+		}
+		if (buffer + app.offset == insertPtr && (app.n == 0 || app.n == 1)) {
+			insertPtr += app.length;
+		}
+	}
+	if (_jpg_find_metadata(jpg_buffer_reader_t{ buffer, len }, info, jsonOffset, jsonLen) && jsonOffset + jsonLen <= len) {
+		oldPtr = buffer + jsonOffset - 4 - JPEG_METADATA_ID_LEN;
+		oldLen = 4 + JPEG_METADATA_ID_LEN + jsonLen;
+	}
+	uint8_t header[4 + JPEG_METADATA_ID_LEN] = { 0xFF, 0xE9, (uint8_t)(segmentLen >> 8), (uint8_t)(segmentLen & 0xFF) };
+	memcpy(header + 4, JPEG_METADATA_ID, JPEG_METADATA_ID_LEN);
+	size_t beforeLen = insertPtr - buffer;
+	size_t middleLen = oldPtr - insertPtr;
+	size_t afterLen = endPtr - oldPtr - oldLen;
+	if (file.write(buffer, beforeLen) != beforeLen
+		|| (segmentLen > 0 && file.write(header, sizeof(header)) != sizeof(header))
+		|| (segmentLen > 0 && file.write((const uint8_t*)json.c_str(), json.length()) != json.length())
+		|| file.write(insertPtr, middleLen) != middleLen
+		|| file.write(oldPtr + oldLen, afterLen) != afterLen) {
+		log_e("File write failed %s", _targetFilename.c_str());
+		throw RuntimeError(StringF("[%s:%d] %s:Incomplete file write to %s", __FILE__, __LINE__, objectName().c_str(), _targetFilename.c_str()));
+	}
+	return segmentLen > 0;
+}
+
 // Variadic filename formatting
 Image& Image::toFile(FS& fs, const char* format, ...) {
 	char buffer[FN_BUF_LEN];
@@ -601,6 +1629,13 @@ void Image::save(existing_image_file_on_save_t existing_file_option) {
 	if (! _to) {
 		throw LogicError(StringF("[%s:%d] %s:Missing toFile() clause", __FILE__, __LINE__, objectName().c_str()));
 	}
+	// Uncompressed images are converted to BMP row by row as they are written
+	String lowerFilename = _targetFilename;
+	lowerFilename.toLowerCase();
+	bool streamBmp = lowerFilename.endsWith(".bmp") && (type == IMAGE_RGB565 || type == IMAGE_RGB888 || type == IMAGE_GRAYSCALE8);
+	if (type != IMAGE_JPEG && type != IMAGE_BMP && !streamBmp) {
+		throw LogicError(StringF("[%s:%d] %s: Cannot save %s as %s, convertTo() JPEG or save as .bmp", __FILE__, __LINE__, objectName().c_str(), typeName().c_str(), _targetFilename.c_str()));
+	}
 	if (_targetFS->exists(_targetFilename) ) {
 		//log_i("Overwriting");
 		if (existing_file_option == OVERWRITE_EXISTING_IMAGE_FILE) {
@@ -637,6 +1672,13 @@ void Image::save(existing_image_file_on_save_t existing_file_option) {
 		throw LogicError(StringF("[%s:%d] %s:Invalid filename %s", __FILE__, __LINE__, objectName().c_str(), _targetFilename.c_str()));
 	} 
 
+	bool embedded = false;
+	if (streamBmp) {
+		writeBmp(file);
+	} else
+	if (type == IMAGE_JPEG) {
+		embedded = writeJpegMetadata(file);
+	} else
 	if (file.write(buffer, len) != len) {
 		log_e("File write failed %s", _targetFilename);
 		throw RuntimeError(StringF("[%s:%d] %s:Incomplete file write to %s", __FILE__, __LINE__, objectName().c_str(), _targetFilename.c_str()));
@@ -644,10 +1686,10 @@ void Image::save(existing_image_file_on_save_t existing_file_option) {
 	//  log_d("Finished writing to %s\n", path);
 	}
 	file.close();
-	// Write out metadata if any
+	// Write out metadata if any, unless it is in the JPEG
 	String metadataFilename = _targetFilename.substring(0, _targetFilename.indexOf(".")) + ".json";
 
-	if (metadata.size() > 0) {
+	if (!embedded && metadata.size() > 0) {
 
 		if (_targetFS->exists(metadataFilename) ) {
 			//log_i("Overwriting");
@@ -667,13 +1709,8 @@ void Image::save(existing_image_file_on_save_t existing_file_option) {
 			log_e("File open failed %s", metadataFilename.c_str());
 			throw LogicError(StringF("[%s:%d] %s:Invalid filename %s", __FILE__, __LINE__, objectName().c_str(), metadataFilename.c_str()));
 		} 
-		String json = "{ \"metadata\" : [";
-		for (auto el : metadata) {
-			String line = StringF("{ \"%s\": \"%s\", \"%s\": \"%s\" }\n", "label", el.first, "value", el.second);
-			//log_i("Line %s", line.c_str());
-			json += line;
-		}
-		json += "]\n}";
+		String json;
+		metadata_json::write(metadata, json);
 
 		if (file.write((const uint8_t*)json.c_str(), json.length()) != json.length()) {
 			log_e("File write failed %s", metadataFilename);
@@ -684,7 +1721,8 @@ void Image::save(existing_image_file_on_save_t existing_file_option) {
 		file.close();
 
 	} else {
-		// No metadata so remove what might be there
+		// No metadata, or it is in the JPEG, so remove what might be there. Load falls back to a sidecar
+		// when a JPEG has no metadata segment, so one left behind would bring back stale metadata
 		if (_targetFS->exists(metadataFilename) ) {
 			//log_i("Deleting metadata");
 			_targetFS->remove(metadataFilename);
@@ -705,6 +1743,10 @@ void Image::setPixel(int x, int y, int r, int g, int b) {
 	}
 	if (type == IMAGE_RGB565) {
 		uint16_t pixelVal = r << 11 | g << 5 | b;
+		if (_pixelOrder == PIXEL_ORDER_NATIVE) {
+			((uint16_t*)buffer)[y * width + x] = pixelVal;
+			return;
+		}
 		uint8_t h = pixelVal >> 8;
 		uint8_t l = pixelVal & 0xFF;
 		buffer[2 * (y * width + x)] = h; // Store in big-endian form for compatibility with the majority of the broken esp-camera driver
@@ -722,9 +1764,12 @@ void Image::setPixel(int x, int y, int r, int g, int b) {
 }
 
 int Image::greyAt(int x, int y) {
-	if (x < 0 || x > width || y < 0 || y > height) {
+	if (x < 0 || x >= width || y < 0 || y >= height) {
 		throw LogicError(StringF("[%s:%d] %s: %d, %d is out of bounds", __FILE__, __LINE__, objectName().c_str(), x, y));
 	}
+	if (type == IMAGE_GRAYSCALE8) {
+		return buffer[y * width + x];
+	}
 	return pixelAt(x, y).grey();
 }
 
@@ -734,15 +1779,19 @@ Pixel Image::pixelAt(int x, int y) {
 	}
 	if (type == IMAGE_RGB565) {
 		auto pixBuf = (uint16_t*)buffer;
-		return Pixel(pixBuf[y * width + x]);
+		return Pixel(pixBuf[y * width + x], _pixelOrder);
 	} else
 	if (type == IMAGE_RGB888) {
 		uint8_t* ppixel = buffer + 3 * (y * width + x);
 		return Pixel(*(ppixel + 2), *(ppixel + 1), *ppixel); // Stored as B G R in memory
 	} else 
 	if (type == IMAGE_BMP) {
-		uint8_t* ppixel = buffer + 3 * (y * width + x) + BMP_HEADER_LEN; 
+		uint8_t* ppixel = buffer + _bmp_row_offset(buffer, width, height, y) + 3 * x;
 		return Pixel(*(ppixel + 2), *(ppixel + 1), *ppixel); // Stored as B G R in memory
+	} else
+	if (type == IMAGE_GRAYSCALE8) {
+		uint8_t grey = buffer[y * width + x];
+		return Pixel(grey, grey, grey);
 	} else {
 		throw LogicError(StringF("[%s:%d] %s: Cannot get pixelAt() for %s", __FILE__, __LINE__, objectName().c_str(), typeName().c_str()));
 	}
@@ -772,114 +1821,416 @@ bool noMask(int x, int y, int width, int height) {
 // - return a true/false value that indicates if the compared Pixels differ in some arbitrary way
 //   by more than a threshold value.  False indicates no significant difference
 // The compareWith() method returns a float being the number of such differing pixels divided by the number of pixels checked.
+// Callers passing a lambda get the inlined template in esp_image.h; this overload keeps std::function callers working.
 float Image::compareWith(Image& that, int stride, comparisonFunction compareFunc, maskFunction maskFunc) {
-	if (width != that.width && height != that.height) {
-		throw LogicError(StringF("[%s:%d] %s and %s are not the same size", __FILE__, __LINE__, objectName().c_str(), that.objectName().c_str()));
+	return compareWith<comparisonFunction, maskFunction>(that, stride, compareFunc, maskFunc);
+}
+
+// Built-in form of the most common comparison: count pixels whose grey values differ by more than threshold
+// (in either direction). Returns the same ratio as compareWith() but works on whole runs of pixels at a time
+// using SIMD where the target has it, so an unmasked or simply masked compare is many times faster.
+float Image::compareGreyThreshold(Image& that, int threshold, int stride, maskFunction maskFunc) {
+	checkComparable(that, stride, true);
+	int bytesPerPixel = type == IMAGE_GRAYSCALE8 ? 1 : 2;
+	auto countDiffs = type == IMAGE_GRAYSCALE8 ? image_kernels::countByteDiffs : _pixelOrder == PIXEL_ORDER_NATIVE ? image_kernels::countGreyDiffsNative : image_kernels::countGreyDiffs;
+	int rows = (height + stride - 1) / stride;
+	int bands = rowBands(rows);
+	band_counts_t counts[ROW_BANDS_MAX];
+	forEachRowBand(rows, bands, [&](int band, int firstRow, int lastRow) {
+		int comparedCount = 0;
+		int diffCount = 0;
+		for (int y = firstRow * stride; y < lastRow * stride; y += stride) {
+			const uint8_t* thisRow = buffer + bytesPerPixel * y * width;
+			const uint8_t* thatRow = that.buffer + bytesPerPixel * y * width;
+			if (!maskFunc) {
+				int count = (width + stride - 1) / stride;
+				comparedCount += count;
+				diffCount += countDiffs(thisRow, thatRow, count, stride, threshold);
+				continue;
+			}
+			// Hand runs of unmasked pixels to the kernel together
+			int runStart = -1;
+			for (int x = 0; runStart >= 0 || x < width; x += stride) {
+				bool inMask = x < width && maskFunc(x, y, width, height);
+				if (inMask && runStart < 0) {
+					runStart = x;
+				} else
+				if (!inMask && runStart >= 0) {
+					int count = (x - runStart) / stride;
+					comparedCount += count;
+					diffCount += countDiffs(thisRow + bytesPerPixel * runStart, thatRow + bytesPerPixel * runStart, count, stride, threshold);
+					runStart = -1;
+				}
+			}
+		}
+		counts[band] = { comparedCount, diffCount };
+	});
+	int comparedCount = 0;
+	int diffCount = 0;
+	for (int band = 0; band < bands; band++) {
+		comparedCount += counts[band].compared;
+		diffCount += counts[band].diffs;
 	}
-	if (type != IMAGE_RGB565 || that.type != IMAGE_RGB565) {
-		throw LogicError(StringF("[%s:%d] %s and %s are not the same type", __FILE__, __LINE__, objectName().c_str(), that.objectName().c_str()));
+	log_i("diffCount = %d, compared = %d", diffCount, comparedCount);
+	return (float)diffCount / comparedCount;
+}
+
+float Image::compareGreyThreshold(Image& that, int threshold, int stride, const Mask& mask) {
+	checkComparable(that, stride, true);
+	int bytesPerPixel = type == IMAGE_GRAYSCALE8 ? 1 : 2;
+	auto countDiffs = type == IMAGE_GRAYSCALE8 ? image_kernels::countByteDiffs : _pixelOrder == PIXEL_ORDER_NATIVE ? image_kernels::countGreyDiffsNative : image_kernels::countGreyDiffs;
+	checkMask(mask);
+	int rows = (height + stride - 1) / stride;
+	int bands = rowBands(rows);
+	band_counts_t counts[ROW_BANDS_MAX];
+	forEachRowBand(rows, bands, [&](int band, int firstRow, int lastRow) {
+		int comparedCount = 0;
+		int diffCount = 0;
+		for (int y = firstRow * stride; y < lastRow * stride; y += stride) {
+			const uint8_t* thisRow = buffer + bytesPerPixel * y * width;
+			const uint8_t* thatRow = that.buffer + bytesPerPixel * y * width;
+			for (const Mask::Span* span = mask.rowBegin(y); span != mask.rowEnd(y); span++) {
+				int x = Mask::firstOnStride(span->start, stride);
+				if (x >= span->end) continue;
+				int count = (span->end - 1 - x) / stride + 1;
+				comparedCount += count;
+				diffCount += countDiffs(thisRow + bytesPerPixel * x, thatRow + bytesPerPixel * x, count, stride, threshold);
+			}
+		}
+		counts[band] = { comparedCount, diffCount };
+	});
+	int comparedCount = 0;
+	int diffCount = 0;
+	for (int band = 0; band < bands; band++) {
+		comparedCount += counts[band].compared;
+		diffCount += counts[band].diffs;
 	}
-	if (stride < 1) {
-		throw LogicError(StringF("[%s:%d] %s: Stride must be 1 or more", __FILE__, __LINE__, objectName().c_str()));
+	log_i("diffCount = %d, compared = %d", diffCount, comparedCount);
+	return (float)diffCount / comparedCount;
+}
+
+float Image::compareGreyThreshold(Image& that, int threshold, DiffMap& diffMap) {
+	checkComparable(that, 1, true);
+	int bytesPerPixel = type == IMAGE_GRAYSCALE8 ? 1 : 2;
+	auto countDiffs = type == IMAGE_GRAYSCALE8 ? image_kernels::countByteDiffs : _pixelOrder == PIXEL_ORDER_NATIVE ? image_kernels::countGreyDiffsNative : image_kernels::countGreyDiffs;
+	diffMap.reset(width, height);
+	int cellWidth = diffMap.cellWidth();
+	int diffCount = 0;
+	for (int y = 0; y < height; y++) {
+		const uint8_t* thisRow = buffer + bytesPerPixel * y * width;
+		const uint8_t* thatRow = that.buffer + bytesPerPixel * y * width;
+		int cellRow = y / diffMap.cellHeight();
+		for (int column = 0, x = 0; x < width; column++, x += cellWidth) {
+			int count = x + cellWidth > width ? width - x : cellWidth;
+			int diffs = countDiffs(thisRow + bytesPerPixel * x, thatRow + bytesPerPixel * x, count, 1, threshold);
+			diffMap.add(column, cellRow, count, diffs);
+			diffCount += diffs;
+		}
 	}
+	return (float)diffCount / (width * height);
+}
+
+float Image::compareGreyThreshold(Image& that, int threshold, DiffMap& diffMap, const Mask& mask) {
+	checkComparable(that, 1, true);
+	checkMask(mask);
+	int bytesPerPixel = type == IMAGE_GRAYSCALE8 ? 1 : 2;
+	auto countDiffs = type == IMAGE_GRAYSCALE8 ? image_kernels::countByteDiffs : _pixelOrder == PIXEL_ORDER_NATIVE ? image_kernels::countGreyDiffsNative : image_kernels::countGreyDiffs;
+	diffMap.reset(width, height);
+	int cellWidth = diffMap.cellWidth();
 	int comparedCount = 0;
 	int diffCount = 0;
-	for (int y = 0; y < height; y += stride) {
-		for (int x = 0; x < width; x += stride) {
-			if (maskFunc == nullptr || maskFunc(x, y, width, height)) {
-				comparedCount ++;
-				diffCount += compareFunc(x, y, pixelAt(x, y), that.pixelAt(x, y)) ? 1 : 0;
+	for (int y = 0; y < height; y++) {
+		const uint8_t* thisRow = buffer + bytesPerPixel * y * width;
+		const uint8_t* thatRow = that.buffer + bytesPerPixel * y * width;
+		int cellRow = y / diffMap.cellHeight();
+		for (const Mask::Span* span = mask.rowBegin(y); span != mask.rowEnd(y); span++) {
+			// Split the span where it crosses cells
+			for (int x = span->start; x < span->end; ) {
+				int column = x / cellWidth;
+				int end = (column + 1) * cellWidth < span->end ? (column + 1) * cellWidth : span->end;
+				int diffs = countDiffs(thisRow + bytesPerPixel * x, thatRow + bytesPerPixel * x, end - x, 1, threshold);
+				diffMap.add(column, cellRow, end - x, diffs);
+				comparedCount += end - x;
+				diffCount += diffs;
+				x = end;
 			}
 		}
 	}
-	log_i("diffCount = %d, compared = %d", diffCount, comparedCount);
 	return (float)diffCount / comparedCount;
 }
 
-int Image::maxGrey(maskFunction maskFunc) {
-	if (type != IMAGE_RGB565) {
-		throw LogicError(StringF("[%s:%d] %s should be RGB565", __FILE__, __LINE__, objectName().c_str(), objectName()));
+float Image::compareJpegWith(Image& reference, int threshold, scaling_type_t scaling, maskFunction maskFunc) {
+	return compareJpeg(reference, threshold, scaling, maskFunc ? &maskFunc : nullptr, nullptr);
+}
+
+float Image::compareJpegWith(Image& reference, int threshold, scaling_type_t scaling, const Mask& mask) {
+	reference.checkMask(mask);
+	return compareJpeg(reference, threshold, scaling, nullptr, &mask);
+}
+
+float Image::compareJpeg(Image& reference, int threshold, scaling_type_t scaling, const maskFunction* maskFunc, const Mask* mask) {
+	if (type != IMAGE_JPEG) {
+		throw LogicError(StringF("[%s:%d] %s should be JPEG", __FILE__, __LINE__, objectName().c_str()));
+	}
+	if (reference.type != IMAGE_RGB565 && reference.type != IMAGE_GRAYSCALE8) {
+		throw LogicError(StringF("[%s:%d] %s should be RGB565 or Grayscale8", __FILE__, __LINE__, reference.objectName().c_str()));
+	}
+	if ((width >> scaling) != reference.width || (height >> scaling) != reference.height) {
+		throw LogicError(StringF("[%s:%d] %s and %s are not the same size", __FILE__, __LINE__, objectName().c_str(), reference.objectName().c_str()));
 	}
-	int maxGrey = 0;
-	for (int y = 0; y < height; y += 1) {
-		for (int x = 0; x < width; x += 1) {
-			if (maskFunc == nullptr || maskFunc(x, y, width, height)) {
-				if (greyAt(x, y) > maxGrey) maxGrey = greyAt(x, y);
+	jpg_comparison_t cmp;
+	cmp.jpeg.input = buffer;
+	cmp.jpeg.output = nullptr;
+	cmp.jpeg.data_offset = 0;
+	cmp.jpeg.width = 0;
+	cmp.jpeg.height = 0;
+	cmp.jpeg.window = nullptr;
+	cmp.reference = reference.buffer;
+	cmp.referenceWidth = reference.width;
+	cmp.referenceHeight = reference.height;
+	cmp.referenceIsGrey = reference.type == IMAGE_GRAYSCALE8;
+	cmp.referenceOrder = reference.pixelOrder();
+	cmp.threshold = threshold;
+	cmp.maskFunc = maskFunc;
+	cmp.mask = mask;
+	cmp.comparedCount = 0;
+	cmp.diffCount = 0;
+	// jpg_comparison_t starts with the jpg_decoder that _jpg_read expects
+	esp_jpg_decode(len, (jpg_scale_t)scaling, _jpg_read, _compare_write, (void*)&cmp);
+	if (cmp.jpeg.width != reference.width || cmp.jpeg.height != reference.height) {
+		throw LogicError(StringF("[%s, %d] %s: expected %d x %d but JPEG decoded as %d x %d", __FILE__, __LINE__, objectName().c_str(), reference.width, reference.height, cmp.jpeg.width, cmp.jpeg.height));
+	}
+	log_i("diffCount = %d, compared = %d", cmp.diffCount, cmp.comparedCount);
+	return (float)cmp.diffCount / cmp.comparedCount;
+}
+
+void Image::checkMask(const Mask& mask) {
+	if (mask.width() != width || mask.height() != height) {
+		throw LogicError(StringF("[%s:%d] %s: Mask is %d x %d but image is %d x %d", __FILE__, __LINE__, objectName().c_str(), mask.width(), mask.height(), width, height));
+	}
+}
+
+void Image::checkComparable(Image& that, int stride, bool greyAllowed) {
+	if (width != that.width || height != that.height) {
+		throw LogicError(StringF("[%s:%d] %s and %s are not the same size", __FILE__, __LINE__, objectName().c_str(), that.objectName().c_str()));
+	}
+	bool comparableType = type == IMAGE_RGB565 || (greyAllowed && type == IMAGE_GRAYSCALE8);
+	if (!comparableType || that.type != type) {
+		throw LogicError(StringF("[%s:%d] %s and %s are not the same type", __FILE__, __LINE__, objectName().c_str(), that.objectName().c_str()));
+	}
+	if (type == IMAGE_RGB565 && that._pixelOrder != _pixelOrder) {
+		throw LogicError(StringF("[%s:%d] %s and %s are not in the same pixel order", __FILE__, __LINE__, objectName().c_str(), that.objectName().c_str()));
+	}
+	if (stride < 1) {
+		throw LogicError(StringF("[%s:%d] %s: Stride must be 1 or more", __FILE__, __LINE__, objectName().c_str()));
+	}
+}
+
+uint8_t* Image::rowPointer(int y) {
+	switch (type) {
+		case IMAGE_RGB565:
+			return buffer + 2 * y * width;
+		case IMAGE_RGB888:
+			return buffer + 3 * y * width;
+		case IMAGE_BMP:
+			return buffer + _bmp_row_offset(buffer, width, height, y);
+		case IMAGE_GRAYSCALE8:
+			return buffer + y * width;
+		default:
+			throw LogicError(StringF("[%s:%d] %s: Cannot access the pixels of %s", __FILE__, __LINE__, objectName().c_str(), typeName().c_str()));
+	}
+}
+
+int Image::bytesPerPixel() {
+	switch (type) {
+		case IMAGE_RGB565:
+			return 2;
+		case IMAGE_RGB888:
+		case IMAGE_BMP:
+			return 3;
+		case IMAGE_GRAYSCALE8:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+void Image::greyRow(int x, int y, int count, uint8_t* grey) {
+	const uint8_t* row = rowPointer(y);
+	switch (type) {
+		case IMAGE_RGB565:
+			if (_pixelOrder == PIXEL_ORDER_NATIVE) {
+				image_kernels::rgb565ToGreyNative(row + 2 * x, grey, count);
+			} else {
+				image_kernels::rgb565ToGrey(row + 2 * x, grey, count);
+			}
+			break;
+		case IMAGE_RGB888:
+		case IMAGE_BMP:
+			image_kernels::bgrToGrey(row + 3 * x, grey, count);
+			break;
+		default:
+			memcpy(grey, row + x, count);
+	}
+}
+
+uint8_t* Image::create(image_type_t imageType, int newWidth, int newHeight) {
+	if (imageType != IMAGE_RGB565 && imageType != IMAGE_RGB888 && imageType != IMAGE_GRAYSCALE8) {
+		throw LogicError(StringF("[%s:%d] %s: Cannot create %s", __FILE__, __LINE__, objectName().c_str(), imageTypeName[imageType]));
+	}
+	if (newWidth <= 0 || newWidth > 0xFFFF || newHeight <= 0 || newHeight > 0xFFFF) {
+		throw LogicError(StringF("[%s:%d] %s: Cannot create %d x %d", __FILE__, __LINE__, objectName().c_str(), newWidth, newHeight));
+	}
+	size_t newLen = (size_t)newWidth * newHeight * (imageType == IMAGE_RGB565 ? 2 : imageType == IMAGE_RGB888 ? 3 : 1);
+	// Nothing is read from the old buffer so it can always be reused if it fits
+	_sourceBuffer = nullptr;
+	_sourceLen = 0;
+	_from = false;
+	acquireTargetBuffer(newLen);
+	adoptTargetBuffer();
+	len = newLen;
+	width = newWidth;
+	height = newHeight;
+	type = imageType;
+	_pixelOrder = _preferredOrder;
+	_sourceName = "";
+	return buffer;
+}
+
+void Image::setPixelOrder(pixel_order_t order) {
+	_preferredOrder = order;
+	if (type == IMAGE_RGB565 && buffer != nullptr && _pixelOrder != order) {
+		image_kernels::swapRgb565(buffer, buffer, len / 2);
+	}
+	_pixelOrder = order;
+}
+
+// Gather min, max, mean, variance and a histogram of the grey values in one pass over the buffer
+// Bands after the first gather into stats of their own, merged into result in band order
+ImageStats Image::stats(maskFunction maskFunc, bool channels) {
+	ImageStats result(channels);
+	int pixelBytes = bytesPerPixel();
+	int bands = rowBands(height);
+	std::vector<ImageStats> bandStats;
+	if (bands > 1) bandStats.assign(bands - 1, ImageStats(channels));
+	forEachRowBand(height, bands, [&](int band, int firstRow, int lastRow) {
+		ImageStats& stats = band == 0 ? result : bandStats[band - 1];
+		for (int y = firstRow; y < lastRow; y++) {
+			const uint8_t* row = rowPointer(y);
+			if (!maskFunc) {
+				stats.add(type, row, width, _pixelOrder);
+				continue;
+			}
+			// Hand runs of unmasked pixels over together
+			int runStart = -1;
+			for (int x = 0; x <= width; x++) {
+				bool inMask = x < width && maskFunc(x, y, width, height);
+				if (inMask && runStart < 0) {
+					runStart = x;
+				} else
+				if (!inMask && runStart >= 0) {
+					stats.add(type, row + pixelBytes * runStart, x - runStart, _pixelOrder);
+					runStart = -1;
+				}
 			}
 		}
+	});
+	for (auto& stats : bandStats) {
+		result.merge(stats);
 	}
-	return maxGrey;
+	result.finish();
+	return result;
+}
+
+ImageStats Image::stats(const Mask& mask, bool channels) {
+	checkMask(mask);
+	ImageStats result(channels);
+	int pixelBytes = bytesPerPixel();
+	int bands = rowBands(height);
+	std::vector<ImageStats> bandStats;
+	if (bands > 1) bandStats.assign(bands - 1, ImageStats(channels));
+	forEachRowBand(height, bands, [&](int band, int firstRow, int lastRow) {
+		ImageStats& stats = band == 0 ? result : bandStats[band - 1];
+		for (int y = firstRow; y < lastRow; y++) {
+			const uint8_t* row = rowPointer(y);
+			for (const Mask::Span* span = mask.rowBegin(y); span != mask.rowEnd(y); span++) {
+				stats.add(type, row + pixelBytes * span->start, span->end - span->start, _pixelOrder);
+			}
+		}
+	});
+	for (auto& stats : bandStats) {
+		result.merge(stats);
+	}
+	result.finish();
+	return result;
+}
+
+int Image::maxGrey(maskFunction maskFunc) {
+	return stats(maskFunc).max;
+}
+
+int Image::maxGrey(const Mask& mask) {
+	return stats(mask).max;
 }
 
 int Image::minGrey(maskFunction maskFunc) {
+	return stats(maskFunc).min;
+}
+
+int Image::minGrey(const Mask& mask) {
+	return stats(mask).min;
+}
+
+void Image::foreachPixel(maskFunction maskFunc, actionFunction actionFunc) {
 	if (type != IMAGE_RGB565) {
 		throw LogicError(StringF("[%s:%d] %s should be RGB565", __FILE__, __LINE__, objectName().c_str(), objectName()));
 	}
-	int minGrey = 0;
-	for (int y = 0; y < height; y += 1) {
-		for (int x = 0; x < width; x += 1) {
-			if (maskFunc == nullptr || maskFunc(x, y, width, height)) {
-				if (greyAt(x, y) < minGrey) minGrey = greyAt(x, y);
+	forEachRowBand(height, rowBands(height), [&](int band, int firstRow, int lastRow) {
+		for (int y = firstRow; y < lastRow; y += 1) {
+			for (int x = 0; x < width; x += 1) {
+				if (maskFunc == nullptr || maskFunc(x, y, width, height)) {
+					actionFunc(x, y, pixelAt(x, y));
+				}
 			}
 		}
-	}
-	return minGrey;
+	});
 }
-void Image::foreachPixel(maskFunction maskFunc, actionFunction actionFunc) {
+
+void Image::foreachPixel(const Mask& mask, actionFunction actionFunc) {
 	if (type != IMAGE_RGB565) {
 		throw LogicError(StringF("[%s:%d] %s should be RGB565", __FILE__, __LINE__, objectName().c_str(), objectName()));
 	}
-	for (int y = 0; y < height; y += 1) {
-		for (int x = 0; x < width; x += 1) {
-			if (maskFunc == nullptr || maskFunc(x, y, width, height)) {
-				actionFunc(x, y, pixelAt(x, y));
+	checkMask(mask);
+	forEachRowBand(height, rowBands(height), [&](int band, int firstRow, int lastRow) {
+		for (int y = firstRow; y < lastRow; y += 1) {
+			const uint16_t* row = (const uint16_t*)buffer + y * width;
+			for (const Mask::Span* span = mask.rowBegin(y); span != mask.rowEnd(y); span++) {
+				for (int x = span->start; x < span->end; x++) {
+					actionFunc(x, y, Pixel(row[x], _pixelOrder));
+				}
 			}
 		}
+	});
+}
+
+// Bands to split rows into: one per ROW_BAND_MIN_ROWS rows, up to a few per worker so that tasks which finish
+// early (e.g. on a sparsely masked band) can take another. Depends only on rows and the executor
+int Image::rowBands(int rows) {
+	if (_executor == nullptr || _executor->workers() < 2) {
+		return 1;
 	}
+	int bands = std::min(rows / ROW_BAND_MIN_ROWS, std::min(4 * _executor->workers(), ROW_BANDS_MAX));
+	return bands > 1 ? bands : 1;
 }
 
 void Image::clear() {
-	if (buffer) {
-		delete[] buffer;
-		buffer = 0;
-	}
+	releaseBuffer();
 	len = 0;
 	_sourceName = "";
 	width = 0;
 	height = 0;
 	type = IMAGE_NONE;
 	timestamp = { 0, 0 };
+	_jpegInfoParsed = false;
 	_from = false;
 }
-
-String Image::readFileToChar(File& file, char endChar) {
-	String ret = "";
-
-	while(file.available()) {
-		char c = file.read();
-		ret += c;
-		if (c == endChar) {
-			return ret;
-		}
-	}
-	return ret;
-}
-
-std::vector<String> Image::split(const String& source, char splitChar) {
-
-	std::vector<String> strings;
-	size_t current, previous = 0;
-	current = source.indexOf(splitChar);
-	String section;
-	while (current != -1) {
-		section = source.substring(previous, current);
-		section.trim();
-		strings.push_back(section);
-		previous = current + 1;
-		current = source.indexOf(splitChar, previous);
-	}
-	section = source.substring(previous);
-	section.trim();
-	strings.push_back(section);
-	return strings;
-}
\ No newline at end of file
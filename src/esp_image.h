@@ -7,6 +7,16 @@
 #include "AppException.h"
 #include "map"
 #include "vector"
+#include "type_traits"
+#include "math.h"
+#include "esp_image_kernels.h"
+#include "esp_image_pool.h"
+#include "esp_image_resize.h"
+#include "esp_image_integral.h"
+#include "esp_image_diffmap.h"
+#include "esp_image_background.h"
+#include "esp_image_metadata.h"
+#include "esp_image_executor.h"
 
 typedef enum {
     IMAGE_NONE,
@@ -18,6 +28,8 @@ typedef enum {
     IMAGE_MAX
 } image_type_t;
 
+extern const char* imageTypeName[IMAGE_MAX];
+
 typedef enum {
     SCALING_NONE,
     SCALING_DIVIDE_2,
@@ -27,14 +39,37 @@ typedef enum {
     SCALING_DIVIDE_32
 } scaling_type_t;
 
+// A window onto a JPEG file, which is decoded through it rather than being read into memory first
+typedef struct {
+        File* file;
+        size_t start;       // File offset of data[0]
+        size_t len;         // Valid bytes in data
+        uint8_t* data;
+        size_t size;
+} jpg_file_window_t;
+
 typedef struct {
         uint16_t width;
         uint16_t height;
         uint16_t data_offset;
         const uint8_t *input;
         uint8_t *output;
+        jpg_file_window_t* window;  // Read from here instead of input when set
 } jpg_decoder;
 
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;     // 0 when there is no region
+    uint16_t height;
+} image_region_t;
+
+typedef struct {
+    uint8_t quality;    // 1 (smallest) to 100 (best), the highest to try when targetLen is set
+    uint8_t minQuality; // Lowest quality to try when targetLen is set
+    size_t targetLen;   // 0, or the most bytes the JPEG should take
+} jpeg_encoding_t;
+
 typedef enum {
     IGNORE_MISSING_IMAGE_FILE,
     THROW_IF_MISSING_IMAGE
@@ -63,20 +98,37 @@ typedef struct {
 } bmp_header_t;
 
 static const int BMP_HEADER_LEN = 54;
+// Most bytes of BMP rows save() converts before each write
+static const size_t BMP_WRITE_BUFFER_LEN = 4096;
+// Bytes of a JPEG file held in memory while convertTo() decodes it straight from the file
+static const size_t JPEG_READ_WINDOW_LEN = 4096;
+// Quality convertTo(IMAGE_JPEG) encodes at unless told otherwise
+static const uint8_t JPEG_DEFAULT_QUALITY = 12;
 
 // Windows BMP format
 #define BMP_WIDTH_ADDR 0x12
 #define BMP_HEIGHT_ADDR 0x16
 #define BMP_BPP_ADDR 0x1C
+#define BMP_OFFSET_ADDR 0x0A
+
+// Each row of a 24 bit BMP is padded to a multiple of 4 bytes
+static inline size_t bmpRowStride(int width) {
+    return ((size_t)width * 3 + 3) & ~(size_t)3;
+}
 #define FN_BUF_LEN 60
 
 // JPEG stuff
 
+// Start of an APP9 segment holding the metadata JSON, including the terminating NUL
+#define JPEG_METADATA_ID "ESPIMG"
+static const size_t JPEG_METADATA_ID_LEN = 7;
+
 const uint16_t SOI = 0xD8FF; // FFD8
 const uint16_t SOF0 = 0xC0FF; // FFC0
 const uint16_t SOS = 0xDAFF; // FFDA
 const uint16_t APP0 = 0xE0FF; // FFE0
 const uint16_t APP1 = 0xE1FF; // FFE1 for EXIF
+const uint16_t APP9 = 0xE9FF; // FFE9 for Image metadata, identified by JPEG_METADATA_ID
 const uint16_t EOI = 0xD9FF; // FFD9
 
 typedef struct {
@@ -90,6 +142,30 @@ typedef struct {
     uint8_t imageWidth[2];
 } sof0_segment_t;
 
+typedef struct {
+    uint8_t n;              // APPn
+    uint32_t offset;        // Of the FF of the marker
+    uint16_t length;        // Including the marker
+} jpeg_app_segment_t;
+
+static const int JPEG_INFO_MAX_APP = 16;
+
+// What the headers of a JPEG say, found by walking its segments as far as the start of the scan
+struct JpegInfo {
+    bool valid = false;             // A SOFn segment was found
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint8_t sofType = 0;            // n of the SOFn marker: 0 baseline, 1 extended, 2 progressive
+    uint8_t precision = 0;          // Bits per sample
+    uint8_t components = 0;
+    uint8_t sampling[4] = { 0 };    // Horizontal << 4 | vertical sampling factors of the first components e.g. 0x22 0x11 0x11 for 4:2:0
+    uint8_t quality = 0;            // libjpeg quality (1 to 100) nearest to the luma quantisation table, 0 if there is none
+    uint32_t scanOffset = 0;        // Of the SOS segment, so the headers are the bytes before it
+    uint8_t appCount = 0;
+    jpeg_app_segment_t app[JPEG_INFO_MAX_APP];  // In file order, the first JPEG_INFO_MAX_APP only
+    bool progressive() const { return sofType == 2; }
+};
+
 class Pixel {
     public:
         Pixel(int r, int g, int b) :
@@ -97,10 +173,10 @@ class Pixel {
             g(g),
             b(b) {
         };
-        Pixel(uint16_t rgb565Value) {
+        Pixel(uint16_t rgb565Value, pixel_order_t order = PIXEL_ORDER_CAMERA) {
             // To minimize alterations to the broken esp-camera driver we will have to accept
-            // that RGB565 values will be stored in high-endian form in memory
-            uint16_t lowEndianValue = (rgb565Value & 0xFF00) >> 8 | (rgb565Value & 0xFF) << 8;
+            // that RGB565 values will be stored in high-endian form in memory, unless the Image is in native order
+            uint16_t lowEndianValue = order == PIXEL_ORDER_NATIVE ? rgb565Value : (rgb565Value & 0xFF00) >> 8 | (rgb565Value & 0xFF) << 8;
             r = (lowEndianValue & 0xF800) >> 8;
             g = (lowEndianValue & 0x07E0) >> 3;
             b = (lowEndianValue & 0x001F) << 3;
@@ -130,6 +206,65 @@ bool insideCircle(int x, int y, int width, int height);
 bool outsideCircle(int x, int y, int width, int height);
 bool insideCentralCircle(int x, int y, int width, int height);
 
+// A mask compiled once for a given width x height into runs ('spans') of included pixels per row,
+// so that per-pixel loops only visit included pixels and never call a maskFunction.
+// A Mask is also callable as a maskFunction.
+class Mask {
+    public:
+        typedef struct {
+            uint16_t start;   // First included x
+            uint16_t end;     // One past the last included x
+        } Span;
+        Mask() : _width(0), _height(0), _rowIndex(1, 0) {};
+        Mask(int width, int height, maskFunction maskFunc = noMask);
+        int width() const { return _width; }
+        int height() const { return _height; }
+        bool contains(int x, int y) const;
+        size_t count() const;
+        const Span* rowBegin(int y) const { return _spans.data() + _rowIndex[y]; }
+        const Span* rowEnd(int y) const { return _spans.data() + _rowIndex[y + 1]; }
+        // First x at or after start that lies on a stride, matching the sampling of the unmasked loops
+        static int firstOnStride(int start, int stride) { return (start + stride - 1) / stride * stride; }
+        Mask operator|(const Mask& that) const;
+        Mask operator&(const Mask& that) const;
+        Mask operator~() const;
+        Mask& invert() { return *this = ~*this; }
+        bool operator()(int x, int y, int width, int height) const { return contains(x, y); }
+    private:
+        Mask combine(const Mask& that, bool intersect) const;
+        void addSpan(int start, int end) { _spans.push_back({ (uint16_t)start, (uint16_t)end }); }
+        void endRow() { _rowIndex.push_back(_spans.size()); }
+        int _width;
+        int _height;
+        std::vector<Span> _spans;
+        std::vector<uint32_t> _rowIndex;  // Spans of row y are _spans[_rowIndex[y]] up to _spans[_rowIndex[y + 1]]
+};
+
+// Luma statistics of (the masked part of) an image, gathered in a single pass by Image::stats().
+// min and max are 255 and 0 when no pixels were included.
+class ImageStats {
+    public:
+        ImageStats(bool channels = false);
+        uint32_t count;           // Pixels included
+        uint8_t min;
+        uint8_t max;
+        float mean;
+        float variance;
+        float stddev() const { return sqrtf(variance); }
+        uint32_t histogram[256];  // Pixels per grey value
+        // Per channel histograms, only filled when requested as they are three times the size
+        std::vector<uint32_t> red;
+        std::vector<uint32_t> green;
+        std::vector<uint32_t> blue;
+        bool hasChannels() const { return !red.empty(); }
+        // Grey value at or below which the given fraction (0 to 1) of the included pixels lie
+        int percentile(float fraction) const;
+        void add(image_type_t type, const uint8_t* pixels, int count, pixel_order_t order = PIXEL_ORDER_CAMERA);
+        // Add the histograms of stats gathered over other pixels
+        void merge(const ImageStats& that);
+        void finish();
+};
+
 class Image {
     public:
         Image() : Image("") {};
@@ -143,6 +278,12 @@ class Image {
             _sourceName("") {
                 setObjectName(objectName);
             };
+        // Images own their buffer so they can be moved or swapped but not copied; use fromImage().load() to copy
+        Image(const Image&) = delete;
+        Image& operator=(const Image&) = delete;
+        Image(Image&& that) : Image(that._objectName.c_str()) { swap(that); }
+        Image& operator=(Image&& that);
+        void swap(Image& that);
         ~Image();
         bool hasContent();
         image_type_t type;
@@ -155,6 +296,11 @@ class Image {
         String source() { return _sourceName; }
         String objectName() { return _objectName; };
         std::map<String, String> metadata;
+        // Byte order of the RGB565 pixels in buffer
+        pixel_order_t pixelOrder() { return _pixelOrder; }
+        // Keep RGB565 pixels in this order from now on: the current pixels are swapped in place (through to the
+        // source of a view) and later loads and conversions produce this order. Views keep the order of their source
+        void setPixelOrder(pixel_order_t order);
     private:
         String _objectName;
         String _sourceName;
@@ -168,6 +314,7 @@ class Image {
         std::map<String, String>* _sourceMetadataPtr;
         uint8_t* _targetBuffer;
         size_t _targetLen;
+        size_t _targetSize;
         uint16_t _targetWidth;
         uint16_t _targetHeight;
         image_type_t _targetType;
@@ -178,10 +325,20 @@ class Image {
         FS* _targetFS;
         String _targetFilename;
         bool _to = false;
+        bool _ownsBuffer = true;
+        size_t _bufferSize = 0;  // Allocated size of buffer, which may be more than len
         scaling_type_t _scaling;
+        image_region_t _region = { 0, 0, 0, 0 };
+        jpeg_encoding_t _encoding = { JPEG_DEFAULT_QUALITY, 1, 0 };
+        RowExecutor* _executor = nullptr;
+        pixel_order_t _pixelOrder = PIXEL_ORDER_CAMERA;
+        pixel_order_t _preferredOrder = PIXEL_ORDER_CAMERA;
+        pixel_order_t _sourceOrder = PIXEL_ORDER_CAMERA;
         jpg_decoder jpeg;
-        String readFileToChar(File& file, char endChar);
-        std::vector<String> split(const String& s, char splitChar);
+        JpegInfo _jpegInfo;
+        bool _jpegInfoParsed = false;   // _jpegInfo describes buffer
+        JpegInfo _sourceJpegInfo;
+        bool _sourceJpegInfoParsed = false;
 
     public:
         Image& fromBuffer(uint8_t* buffer, size_t width, size_t height, size_t len, image_type_t imageType, timeval timestamp = { 0, 0 });
@@ -191,27 +348,207 @@ class Image {
         const uint8_t* nextJpegSegment(const uint8_t* startPtr, const uint8_t* endPtr);
         void extractJpegSize(uint16_t& width, uint16_t& height, uint8_t* buffer, size_t len);
         Image& setTrueSize();
+        // Header information of a JPEG image, parsed once and kept until the content changes. Not valid unless a JPEG
+        const JpegInfo& jpegInfo();
+        // Header information of a JPEG file, read without loading it: only the first few KB are read unless
+        // the headers run past them. Not valid if the file is missing or is not a JPEG
+        static JpegInfo probe(FS& fs, const String& path);
         Image& fromImage(Image& sourceImage);
         Image& fromFile(FS& fs, const char* format, ...);
         Image& fromFile(FS& fs, const String& path);
         Image& fromFile(FS& fs, const String& path, image_type_t imageType);
         Image& toFile(FS& fs, const char* format, ...);
         Image& toFile(FS& fs, const String& path);
+        // Only decode (and allocate) this rectangle of the scaled image in the next JPEG convertTo()
+        Image& region(int x, int y, int width, int height);
         void convertTo(image_type_t newImageType) { return convertTo(newImageType, SCALING_NONE); }
         void convertTo(image_type_t newImageType, scaling_type_t scaling);
+        // Encode to JPEG at this quality, 1 (smallest) to 100 (best)
+        void convertTo(image_type_t newImageType, int quality);
+        // Encode to JPEG at the highest quality from minQuality to maxQuality whose file fits in targetLen bytes,
+        // found by bisection. If even minQuality does not fit the image is encoded at minQuality and len exceeds targetLen
+        void convertTo(image_type_t newImageType, size_t targetLen, int minQuality, int maxQuality = 100);
         void load(missing_image_file_on_load_t = IGNORE_MISSING_IMAGE_FILE);
+        // Copy a rectangle of the source (or this image, in place). RGB565, RGB888 and GRAYSCALE8 only
+        void crop(int x, int y, int width, int height);
+        // Resample the source (or this image) to any size, keeping its type. RGB565, RGB888 and GRAYSCALE8 only
+        void resize(int newWidth, int newHeight, resize_method_t method = RESIZE_BILINEAR);
+        // Borrow the source buffer instead of copying it. The view stays valid only while the source does
+        // (until the camera frame is returned, or the source Image is altered or destroyed).
+        // Writes through setPixel() alter the source. detach() takes a private copy when one is needed.
+        void view();
+        void detach();
+        bool isView() { return buffer != nullptr && !_ownsBuffer; }
         void save(existing_image_file_on_save_t = OVERWRITE_EXISTING_IMAGE_FILE);
+        // Make this a width x height image of an uncompressed type, reusing the buffer where possible.
+        // The pixels are not initialised. Returns the buffer to be filled.
+        uint8_t* create(image_type_t imageType, int width, int height);
+        int bytesPerPixel();
+        // Pixels of row y as stored in the buffer (uncompressed types only)
+        uint8_t* rowPointer(int y);
+        // Grey values of count pixels of row y from x, without bounds checks
+        void greyRow(int x, int y, int count, uint8_t* grey);
         void setObjectName(String name);
         void setPixel(int x, int y, int r, int g, int b);
         int greyAt(int x, int y);
+        ImageStats stats(maskFunction maskFunc = nullptr, bool channels = false);
+        ImageStats stats(const Mask& mask, bool channels = false);
+        ImageStats stats(bool (*mFunc)(int, int, int, int), bool channels = false) {
+            return stats(isMasking(mFunc) ? maskFunction(mFunc) : maskFunction(), channels);
+        }
         int maxGrey(maskFunction maskFunc = nullptr);
+        int maxGrey(const Mask& mask);
         int minGrey(maskFunction maskFunc = nullptr);
+        int minGrey(const Mask& mask);
         Pixel pixelAt(int x, int y);
-        float compareWith(Image& that, comparisonFunction cFunc) { return compareWith(that, 1, cFunc, noMask);}
-        float compareWith(Image& that, int stride, comparisonFunction cFunc) { return compareWith(that, stride, cFunc, noMask); }
-        float compareWith(Image& that, comparisonFunction cFunc, maskFunction mFunc) { return compareWith(that, 1, cFunc, mFunc); }
+        // Any callable (lambda, functor, function pointer) is taken by value so that it can be inlined
+        template<typename CompareFunc>
+        float compareWith(Image& that, CompareFunc cFunc) { return compareWith(that, 1, cFunc, noMask); }
+        template<typename CompareFunc>
+        float compareWith(Image& that, int stride, CompareFunc cFunc) { return compareWith(that, stride, cFunc, noMask); }
+        template<typename CompareFunc, typename MaskFunc>
+        typename std::enable_if<!std::is_arithmetic<CompareFunc>::value, float>::type
+        compareWith(Image& that, CompareFunc cFunc, MaskFunc mFunc) { return compareWith(that, 1, cFunc, mFunc); }
+        template<typename CompareFunc>
+        float compareWith(Image& that, int stride, CompareFunc cFunc, std::nullptr_t) { return compareWith(that, stride, cFunc, noMask); }
+        template<typename CompareFunc>
+        float compareWith(Image& that, CompareFunc cFunc, const Mask& mask) { return compareWith(that, 1, cFunc, mask); }
+        template<typename CompareFunc>
+        float compareWith(Image& that, int stride, CompareFunc cFunc, const Mask& mask);
+        template<typename CompareFunc, typename MaskFunc>
+        float compareWith(Image& that, int stride, CompareFunc cFunc, MaskFunc mFunc);
         float compareWith(Image& that, int stride, comparisonFunction func, maskFunction mFunc);
+        float compareGreyThreshold(Image& that, int threshold, int stride = 1, maskFunction mFunc = nullptr);
+        float compareGreyThreshold(Image& that, int threshold, int stride, const Mask& mask);
+        float compareGreyThreshold(Image& that, int threshold, int stride, bool (*mFunc)(int, int, int, int)) {
+            return compareGreyThreshold(that, threshold, stride, isMasking(mFunc) ? maskFunction(mFunc) : maskFunction());
+        }
+        // As compareGreyThreshold() but also counting the differences per cell of diffMap
+        float compareGreyThreshold(Image& that, int threshold, DiffMap& diffMap);
+        float compareGreyThreshold(Image& that, int threshold, DiffMap& diffMap, const Mask& mask);
+        // compareGreyThreshold() of this JPEG, decoded at the given scaling, against an RGB565 or GRAYSCALE8 reference.
+        // Pixels are compared as each block is decoded so the frame is never held in memory.
+        float compareJpegWith(Image& reference, int threshold, scaling_type_t scaling = SCALING_NONE, maskFunction mFunc = nullptr);
+        float compareJpegWith(Image& reference, int threshold, scaling_type_t scaling, const Mask& mask);
+        float compareJpegWith(Image& reference, int threshold, scaling_type_t scaling, bool (*mFunc)(int, int, int, int)) {
+            return compareJpegWith(reference, threshold, scaling, isMasking(mFunc) ? maskFunction(mFunc) : maskFunction());
+        }
         void foreachPixel(maskFunction mFunc, actionFunction aFunc);
+        void foreachPixel(const Mask& mask, actionFunction aFunc);
+        // Split the row loops of compareWith(), compareGreyThreshold(), foreachPixel() and stats() (so maxGrey() and
+        // minGrey() too) into bands run by executor, or run them on the calling task when it is nullptr. The compare,
+        // mask and action functions are then called from several tasks at once and must be safe to do so
+        void setExecutor(RowExecutor* executor) { _executor = executor; }
+        RowExecutor* executor() { return _executor; }
         void clear();
+    private:
+        void releaseBuffer();
+        uint8_t* acquireTargetBuffer(size_t targetLen);
+        void adoptTargetBuffer();
+        void abandonTargetBuffer();
+        void convertPixels();
+        void writeBmp(File& file);
+        void loadMetadata(std::map<String, String>& fileMetadata);
+        bool extractJpegMetadata(std::map<String, String>& fileMetadata);
+        bool writeJpegMetadata(File& file);
+        void checkComparable(Image& that, int stride, bool greyAllowed = false);
+        void checkMask(const Mask& mask);
+        float compareJpeg(Image& reference, int threshold, scaling_type_t scaling, const maskFunction* maskFunc, const Mask* mask);
+        int rowBands(int rows);
+        template<typename BandFunc>
+        void forEachRowBand(int rows, int bands, BandFunc bandFunc);
+        static bool isMasking(bool (*maskFunc)(int, int, int, int)) { return maskFunc != nullptr && maskFunc != noMask; }
+        static bool isMasking(const maskFunction& maskFunc) { return (bool)maskFunc; }
+        template<typename MaskFunc>
+        static bool isMasking(const MaskFunc&) { return true; }
 };
+
+inline void swap(Image& a, Image& b) { a.swap(b); }
+
+typedef struct {
+    int compared;
+    int diffs;
+} band_counts_t;
+
+// Call bandFunc(band, firstRow, lastRow) for each of bands bands of rows [0, rows), on the executor unless there is one band
+template<typename BandFunc>
+void Image::forEachRowBand(int rows, int bands, BandFunc bandFunc) {
+    if (bands <= 1) {
+        bandFunc(0, 0, rows);
+        return;
+    }
+    _executor->run(bands, [&](int band) {
+        bandFunc(band, (int)((int64_t)rows * band / bands), (int)((int64_t)rows * (band + 1) / bands));
+    });
+}
+
+// Compare this image with another similar one
+// Walks both RGB565 buffers row by row and only unpacks the Pixels of positions the mask allows.
+// See the comparisonFunction overload in esp_image.cpp for the contract of compareFunc.
+template<typename CompareFunc, typename MaskFunc>
+float Image::compareWith(Image& that, int stride, CompareFunc compareFunc, MaskFunc maskFunc) {
+    checkComparable(that, stride);
+    bool masking = isMasking(maskFunc);
+    const pixel_order_t order = _pixelOrder;
+    int rows = (height + stride - 1) / stride;
+    int bands = rowBands(rows);
+    band_counts_t counts[ROW_BANDS_MAX];
+    forEachRowBand(rows, bands, [&](int band, int firstRow, int lastRow) {
+        int comparedCount = 0;
+        int diffCount = 0;
+        for (int y = firstRow * stride; y < lastRow * stride; y += stride) {
+            const uint16_t* thisRow = (const uint16_t*)buffer + y * width;
+            const uint16_t* thatRow = (const uint16_t*)that.buffer + y * that.width;
+            for (int x = 0; x < width; x += stride) {
+                if (!masking || maskFunc(x, y, width, height)) {
+                    comparedCount ++;
+                    diffCount += compareFunc(x, y, Pixel(thisRow[x], order), Pixel(thatRow[x], order)) ? 1 : 0;
+                }
+            }
+        }
+        counts[band] = { comparedCount, diffCount };
+    });
+    int comparedCount = 0;
+    int diffCount = 0;
+    for (int band = 0; band < bands; band++) {
+        comparedCount += counts[band].compared;
+        diffCount += counts[band].diffs;
+    }
+    log_i("diffCount = %d, compared = %d", diffCount, comparedCount);
+    return (float)diffCount / comparedCount;
+}
+
+// As above but only visits the spans of a compiled Mask
+template<typename CompareFunc>
+float Image::compareWith(Image& that, int stride, CompareFunc compareFunc, const Mask& mask) {
+    checkComparable(that, stride);
+    checkMask(mask);
+    const pixel_order_t order = _pixelOrder;
+    int rows = (height + stride - 1) / stride;
+    int bands = rowBands(rows);
+    band_counts_t counts[ROW_BANDS_MAX];
+    forEachRowBand(rows, bands, [&](int band, int firstRow, int lastRow) {
+        int comparedCount = 0;
+        int diffCount = 0;
+        for (int y = firstRow * stride; y < lastRow * stride; y += stride) {
+            const uint16_t* thisRow = (const uint16_t*)buffer + y * width;
+            const uint16_t* thatRow = (const uint16_t*)that.buffer + y * that.width;
+            for (const Mask::Span* span = mask.rowBegin(y); span != mask.rowEnd(y); span++) {
+                for (int x = Mask::firstOnStride(span->start, stride); x < span->end; x += stride) {
+                    comparedCount ++;
+                    diffCount += compareFunc(x, y, Pixel(thisRow[x], order), Pixel(thatRow[x], order)) ? 1 : 0;
+                }
+            }
+        }
+        counts[band] = { comparedCount, diffCount };
+    });
+    int comparedCount = 0;
+    int diffCount = 0;
+    for (int band = 0; band < bands; band++) {
+        comparedCount += counts[band].compared;
+        diffCount += counts[band].diffs;
+    }
+    log_i("diffCount = %d, compared = %d", diffCount, comparedCount);
+    return (float)diffCount / comparedCount;
+}
 #endif
\ No newline at end of file
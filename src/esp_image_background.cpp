@@ -0,0 +1,147 @@
+#include "esp_image.h"
+#include "esp_image_kernels.h"
+
+BackgroundModel::BackgroundModel(float learningRate, bool variance, float sigmas) :
+	_withVariance(variance),
+	_width(0),
+	_height(0),
+	_frameWidth(0),
+	_frameHeight(0),
+	_stride(1),
+	_foreground(nullptr),
+	_foregroundPixels(nullptr) {
+	if (learningRate <= 0 || learningRate > 1) {
+		throw LogicError(StringF("[%s:%d] Learning rate %f should be more than 0 and at most 1", __FILE__, __LINE__, learningRate));
+	}
+	int alpha = (int)(learningRate * 256 + 0.5f);
+	_alpha = alpha < 1 ? 1 : alpha;
+	// Held as sigmas^2 in 1/16ths in 16 bits
+	if (sigmas < 0 || sigmas >= 64) {
+		throw LogicError(StringF("[%s:%d] Sigmas %f should be at least 0 and less than 64", __FILE__, __LINE__, sigmas));
+	}
+	_sigmasSquared = (uint16_t)(sigmas * sigmas * 16 + 0.5f);
+}
+
+// Grey value of pixel x of a GRAYSCALE8 or RGB565 row
+static inline int greyAt(const uint8_t* row, int x, bool isGrey, bool native) {
+	if (isGrey) return row[x];
+	return native ? image_kernels::rgb565GreyNative(((const uint16_t*)row)[x]) : image_kernels::rgb565Grey(row + 2 * x);
+}
+
+// Check the frame and (re)allocate the model if this is the first frame or the size or stride changed
+bool BackgroundModel::start(Image& frame, int stride) {
+	if (frame.type != IMAGE_RGB565 && frame.type != IMAGE_GRAYSCALE8) {
+		throw LogicError(StringF("[%s:%d] %s should be RGB565 or Grayscale8", __FILE__, __LINE__, frame.objectName().c_str()));
+	}
+	if (stride < 1) {
+		throw LogicError(StringF("[%s:%d] %s: Stride must be 1 or more", __FILE__, __LINE__, frame.objectName().c_str()));
+	}
+	bool initialising = !hasBackground() || frame.width != _frameWidth || frame.height != _frameHeight || stride != _stride;
+	if (initialising) {
+		_frameWidth = frame.width;
+		_frameHeight = frame.height;
+		_stride = stride;
+		_width = (frame.width + stride - 1) / stride;
+		_height = (frame.height + stride - 1) / stride;
+		_mean.resize((size_t)_width * _height);
+		if (_withVariance) _variance.assign((size_t)_width * _height, 0);
+		// The whole first frame, masked or not, becomes the background
+		bool isGrey = frame.type == IMAGE_GRAYSCALE8;
+		bool native = frame.pixelOrder() == PIXEL_ORDER_NATIVE;
+		uint16_t* mean = _mean.data();
+		for (int y = 0; y < frame.height; y += stride) {
+			const uint8_t* row = frame.rowPointer(y);
+			for (int x = 0; x < frame.width; x += stride) {
+				*mean++ = greyAt(row, x, isGrey, native) << 8;
+			}
+		}
+	}
+	_foregroundPixels = nullptr;
+	if (_foreground) {
+		_foregroundPixels = _foreground->create(IMAGE_GRAYSCALE8, _width, _height);
+		// Pixels outside the mask are not visited
+		memset(_foregroundPixels, 0, (size_t)_width * _height);
+	}
+	return initialising;
+}
+
+// diff * alpha / 256 rounded to the nearest, halves away from 0. A shift would round towards minus infinity, so
+// small rises would never reach the model while small falls always would, and a static scene would drift dark
+static inline int blend(int diff, int alpha) {
+	int scaled = diff * alpha;
+	return scaled >= 0 ? (scaled + 128) >> 8 : -((128 - scaled) >> 8);
+}
+
+inline bool BackgroundModel::step(size_t i, int grey, int threshold) {
+	int mean = _mean[i];
+	int diff = (grey << 8) - mean;
+	// Blend before deciding so the comparison and update share one read of the model
+	_mean[i] = mean + blend(diff, _alpha);
+	int greyDiff = (diff + 128) >> 8;
+	bool foreground = abs(greyDiff) > threshold;
+	if (_withVariance) {
+		uint32_t squared = greyDiff * greyDiff;
+		uint32_t variance = _variance[i];
+		foreground = foreground & (squared * 16 > variance * _sigmasSquared);
+		_variance[i] = variance + blend((int32_t)squared - (int32_t)variance, _alpha);
+	}
+	if (_foregroundPixels) _foregroundPixels[i] = foreground ? 255 : 0;
+	return foreground;
+}
+
+float BackgroundModel::update(Image& frame, int threshold, int stride, std::function<bool(int, int, int, int)> maskFunc) {
+	if (start(frame, stride)) return 0;
+	bool isGrey = frame.type == IMAGE_GRAYSCALE8;
+	bool native = frame.pixelOrder() == PIXEL_ORDER_NATIVE;
+	int comparedCount = 0;
+	int foregroundCount = 0;
+	for (int y = 0, my = 0; y < frame.height; y += stride, my++) {
+		const uint8_t* row = frame.rowPointer(y);
+		size_t i = (size_t)my * _width;
+		for (int x = 0; x < frame.width; x += stride, i++) {
+			if (maskFunc && !maskFunc(x, y, frame.width, frame.height)) continue;
+			int grey = greyAt(row, x, isGrey, native);
+			foregroundCount += step(i, grey, threshold) ? 1 : 0;
+			comparedCount++;
+		}
+	}
+	return comparedCount == 0 ? 0 : (float)foregroundCount / comparedCount;
+}
+
+float BackgroundModel::update(Image& frame, int threshold, int stride, bool (*maskFunc)(int, int, int, int)) {
+	bool masking = maskFunc != nullptr && maskFunc != noMask;
+	return update(frame, threshold, stride, masking ? std::function<bool(int, int, int, int)>(maskFunc) : nullptr);
+}
+
+float BackgroundModel::update(Image& frame, int threshold, int stride, const Mask& mask) {
+	if (mask.width() != frame.width || mask.height() != frame.height) {
+		throw LogicError(StringF("[%s:%d] %s: Mask is %d x %d but image is %d x %d", __FILE__, __LINE__, frame.objectName().c_str(), mask.width(), mask.height(), frame.width, frame.height));
+	}
+	if (start(frame, stride)) return 0;
+	bool isGrey = frame.type == IMAGE_GRAYSCALE8;
+	bool native = frame.pixelOrder() == PIXEL_ORDER_NATIVE;
+	int comparedCount = 0;
+	int foregroundCount = 0;
+	for (int y = 0, my = 0; y < frame.height; y += stride, my++) {
+		const uint8_t* row = frame.rowPointer(y);
+		size_t rowStart = (size_t)my * _width;
+		for (const Mask::Span* span = mask.rowBegin(y); span != mask.rowEnd(y); span++) {
+			for (int x = Mask::firstOnStride(span->start, stride); x < span->end; x += stride) {
+				int grey = greyAt(row, x, isGrey, native);
+				foregroundCount += step(rowStart + x / stride, grey, threshold) ? 1 : 0;
+				comparedCount++;
+			}
+		}
+	}
+	return comparedCount == 0 ? 0 : (float)foregroundCount / comparedCount;
+}
+
+void BackgroundModel::backgroundImage(Image& target) const {
+	if (!hasBackground()) {
+		throw LogicError(StringF("[%s:%d] BackgroundModel has no background yet", __FILE__, __LINE__));
+	}
+	uint8_t* out = target.create(IMAGE_GRAYSCALE8, _width, _height);
+	for (size_t i = 0; i < _mean.size(); i++) {
+		out[i] = (_mean[i] + 128) >> 8;
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef ESP_IMAGE_BACKGROUND_H
+#define ESP_IMAGE_BACKGROUND_H
+#include <stdint.h>
+#include <stddef.h>
+#include "vector"
+#include "functional"
+
+class Image;
+class Mask;
+
+/*
+** Running average (and optionally running variance) of the grey values of a sequence of RGB565 or
+** GRAYSCALE8 frames, for motion detection against the scene rather than just the previous frame.
+** Each update() compares the frame with the background, counting foreground pixels, and then blends
+** the frame in, all in one pass over the frame. The model is held in fixed point and allocated once.
+** With stride > 1 the model only holds every stride'th pixel of every stride'th row.
+*/
+class BackgroundModel {
+    public:
+        // learningRate is the weight of each new frame (0 to 1). With variance a foreground pixel must
+        // also differ from the mean by more than sigmas (0 to below 64) standard deviations
+        BackgroundModel(float learningRate = 0.05, bool variance = false, float sigmas = 2.5);
+        // Forget the background; the next update() starts again from its frame
+        void reset() { _width = 0; _height = 0; }
+        bool hasBackground() const { return _width > 0; }
+        // Ratio of foreground pixels among the compared ones. The first frame initialises the model and returns 0
+        float update(Image& frame, int threshold, int stride = 1, std::function<bool(int, int, int, int)> maskFunc = nullptr);
+        float update(Image& frame, int threshold, int stride, const Mask& mask);
+        float update(Image& frame, int threshold, int stride, bool (*maskFunc)(int, int, int, int));
+        // Also record which pixels were foreground (255) in a GRAYSCALE8 Image at the model's resolution
+        void keepForeground(Image* foreground) { _foreground = foreground; }
+        // Model resolution, i.e. the frame size divided by the stride
+        int width() const { return _width; }
+        int height() const { return _height; }
+        uint8_t meanAt(int x, int y) const { return (_mean[y * _width + x] + 128) >> 8; }
+        float varianceAt(int x, int y) const { return _variance.empty() ? 0 : _variance[y * _width + x]; }
+        // Replace target with the GRAYSCALE8 mean background
+        void backgroundImage(Image& target) const;
+    private:
+        // Returns true if the frame started a new background
+        bool start(Image& frame, int stride);
+        // Compare and blend one pixel of the model
+        inline bool step(size_t i, int grey, int threshold);
+        uint16_t _alpha;                   // Learning rate in 1/256ths
+        uint16_t _sigmasSquared;           // sigmas^2 in 1/16ths
+        bool _withVariance;
+        int _width;
+        int _height;
+        int _frameWidth;
+        int _frameHeight;
+        int _stride;
+        std::vector<uint16_t> _mean;       // Grey in 1/256ths
+        std::vector<uint16_t> _variance;   // Grey^2
+        Image* _foreground;
+        uint8_t* _foregroundPixels;
+};
+#endif
@@ -0,0 +1,82 @@
+#include "esp_image.h"
+#include "algorithm"
+
+DiffMap::DiffMap(int cellWidth, int cellHeight) :
+	_cellWidth(cellWidth),
+	_cellHeight(cellHeight),
+	_imageWidth(0),
+	_imageHeight(0),
+	_columns(0),
+	_rows(0) {
+	if (cellWidth < 1 || cellHeight < 1) {
+		throw LogicError(StringF("[%s:%d] DiffMap cells of %d x %d are too small", __FILE__, __LINE__, cellWidth, cellHeight));
+	}
+}
+
+void DiffMap::reset(int imageWidth, int imageHeight) {
+	_imageWidth = imageWidth;
+	_imageHeight = imageHeight;
+	_columns = (imageWidth + _cellWidth - 1) / _cellWidth;
+	_rows = (imageHeight + _cellHeight - 1) / _cellHeight;
+	_compared.assign(_columns * _rows, 0);
+	_diffs.assign(_columns * _rows, 0);
+}
+
+float DiffMap::ratio(int column, int row) const {
+	uint32_t n = compared(column, row);
+	return n ? (float)diffs(column, row) / n : 0;
+}
+
+// Label 8-connected groups of changed cells with a flood fill
+std::vector<changed_region_t> DiffMap::regions(float minRatio, int minCells) const {
+	std::vector<changed_region_t> found;
+	std::vector<bool> visited(_columns * _rows, false);
+	std::vector<int> pending;
+	for (int start = 0; start < _columns * _rows; start++) {
+		if (visited[start] || ratio(start % _columns, start / _columns) <= minRatio) continue;
+		int minColumn = _columns, maxColumn = -1, minRow = _rows, maxRow = -1;
+		uint32_t cells = 0, area = 0;
+		double weightedX = 0, weightedY = 0;
+		visited[start] = true;
+		pending.push_back(start);
+		while (!pending.empty()) {
+			int cell = pending.back();
+			pending.pop_back();
+			int column = cell % _columns;
+			int row = cell / _columns;
+			minColumn = std::min(minColumn, column);
+			maxColumn = std::max(maxColumn, column);
+			minRow = std::min(minRow, row);
+			maxRow = std::max(maxRow, row);
+			cells++;
+			area += _diffs[cell];
+			// Centre of the part of the cell inside the image
+			weightedX += _diffs[cell] * (column * _cellWidth + std::min(_cellWidth, _imageWidth - column * _cellWidth) / 2.0);
+			weightedY += _diffs[cell] * (row * _cellHeight + std::min(_cellHeight, _imageHeight - row * _cellHeight) / 2.0);
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					int c = column + dx, r = row + dy;
+					if (c < 0 || c >= _columns || r < 0 || r >= _rows) continue;
+					int neighbour = r * _columns + c;
+					if (!visited[neighbour] && ratio(c, r) > minRatio) {
+						visited[neighbour] = true;
+						pending.push_back(neighbour);
+					}
+				}
+			}
+		}
+		if ((int)cells < minCells) continue;
+		changed_region_t region;
+		region.x = minColumn * _cellWidth;
+		region.y = minRow * _cellHeight;
+		region.width = std::min((maxColumn + 1) * _cellWidth, _imageWidth) - region.x;
+		region.height = std::min((maxRow + 1) * _cellHeight, _imageHeight) - region.y;
+		region.cells = cells;
+		region.area = area;
+		region.centroidX = area ? weightedX / area : region.x + region.width / 2.0f;
+		region.centroidY = area ? weightedY / area : region.y + region.height / 2.0f;
+		found.push_back(region);
+	}
+	std::sort(found.begin(), found.end(), [](const changed_region_t& a, const changed_region_t& b) { return a.area > b.area; });
+	return found;
+}
@@ -0,0 +1,53 @@
+#ifndef ESP_IMAGE_DIFFMAP_H
+#define ESP_IMAGE_DIFFMAP_H
+#include <stdint.h>
+#include <stddef.h>
+#include "vector"
+
+// A group of touching changed cells
+typedef struct {
+    uint16_t x;             // Bounding box in pixels
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+    uint16_t cells;         // Number of changed cells
+    uint32_t area;          // Number of differing pixels in them
+    float centroidX;        // Centre of the differing pixels, weighting each cell centre by its count
+    float centroidY;
+} changed_region_t;
+
+/*
+** Counts of differing pixels per cell of a grid laid over an image, filled in by
+** Image::compareGreyThreshold(that, threshold, diffMap), so that changes can be located as well as measured.
+** regions() merges touching (8-connected) changed cells into bounding boxes.
+*/
+class DiffMap {
+    public:
+        DiffMap(int cellWidth = 16, int cellHeight = 16);
+        int cellWidth() const { return _cellWidth; }
+        int cellHeight() const { return _cellHeight; }
+        int columns() const { return _columns; }
+        int rows() const { return _rows; }
+        uint32_t diffs(int column, int row) const { return _diffs[row * _columns + column]; }
+        uint32_t compared(int column, int row) const { return _compared[row * _columns + column]; }
+        // Ratio of differing to compared pixels in a cell, 0 when nothing in it was compared
+        float ratio(int column, int row) const;
+        // Regions of cells whose ratio is more than minRatio, largest area first
+        std::vector<changed_region_t> regions(float minRatio, int minCells = 1) const;
+        // Used while comparing
+        void reset(int imageWidth, int imageHeight);
+        void add(int column, int row, uint32_t compared, uint32_t diffs) {
+            _compared[row * _columns + column] += compared;
+            _diffs[row * _columns + column] += diffs;
+        }
+    private:
+        int _cellWidth;
+        int _cellHeight;
+        int _imageWidth;
+        int _imageHeight;
+        int _columns;
+        int _rows;
+        std::vector<uint32_t> _compared;
+        std::vector<uint32_t> _diffs;
+};
+#endif
@@ -0,0 +1,121 @@
+#include "esp_image_executor.h"
+#ifdef ESP_PLATFORM
+#include "esp_pthread.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+ThreadPool::ThreadPool(int workers, size_t stackSize) :
+	_band(nullptr),
+	_bands(0),
+	_next(0),
+	_pending(0),
+	_active(0),
+	_generation(0),
+	_failed(false),
+	_running(false),
+	_stopping(false) {
+	if (workers <= 0) {
+		workers = std::thread::hardware_concurrency();
+		if (workers <= 0) workers = 2;
+	}
+#ifdef ESP_PLATFORM
+	// std::thread takes its stack size, name and priority from the pthread config of the creating task, so that
+	// config is put back afterwards for the task's later threads. Left as the default if the task has none
+	esp_pthread_cfg_t previous = esp_pthread_get_default_config();
+	esp_pthread_get_cfg(&previous);
+	esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+	cfg.stack_size = stackSize;
+	cfg.thread_name = "RowWorker";
+	cfg.prio = uxTaskPriorityGet(nullptr);
+	esp_pthread_set_cfg(&cfg);
+#endif
+	for (int i = 1; i < workers; i++) {
+		_threads.push_back(std::thread(&ThreadPool::work, this));
+	}
+#ifdef ESP_PLATFORM
+	esp_pthread_set_cfg(&previous);
+#endif
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_start.notify_all();
+	for (auto& thread : _threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::run(int bands, const std::function<void(int)>& band) {
+	if (_threads.empty() || bands <= 1) {
+		for (int i = 0; i < bands; i++) band(i);
+		return;
+	}
+	std::unique_lock<std::mutex> lock(_mutex);
+	// One run() at a time, and not before every thread has let go of the last one
+	_idle.wait(lock, [this] { return !_running && _active == 0; });
+	_running = true;
+	_band = &band;
+	_bands = bands;
+	_next = 0;
+	_pending = bands;
+	_failed = false;
+	_generation++;
+	lock.unlock();
+	_start.notify_all();
+	takeBands();
+	lock.lock();
+	// Wait even after an exception, as other threads may still be in a band
+	_idle.wait(lock, [this] { return _pending == 0; });
+	std::exception_ptr error = _error;
+	_error = nullptr;
+	_running = false;
+	lock.unlock();
+	_idle.notify_all();
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+// Take bands until there are none left. An exception is kept for run() to rethrow, as it must not escape a thread
+void ThreadPool::takeBands() {
+	int i;
+	while ((i = _next++) < _bands) {
+		if (!_failed) {
+			try {
+				(*_band)(i);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (!_error) _error = std::current_exception();
+				_failed = true;
+			}
+		}
+		// Skipped bands count as done too
+		if (--_pending == 0) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_idle.notify_all();
+		}
+	}
+}
+
+void ThreadPool::work() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	uint32_t joined = _generation;
+	while (true) {
+		_start.wait(lock, [&] { return _stopping || _generation != joined; });
+		if (_stopping) {
+			return;
+		}
+		joined = _generation;
+		_active++;
+		lock.unlock();
+		takeBands();
+		lock.lock();
+		if (--_active == 0) {
+			_idle.notify_all();
+		}
+	}
+}
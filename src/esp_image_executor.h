@@ -0,0 +1,66 @@
+#ifndef ESP_IMAGE_EXECUTOR_H
+#define ESP_IMAGE_EXECUTOR_H
+#include <stdint.h>
+#include <stddef.h>
+#include "atomic"
+#include "vector"
+#include "mutex"
+#include "condition_variable"
+#include "thread"
+#include "functional"
+#include "exception"
+
+// Stack of each ThreadPool task on the ESP32
+static const size_t ROW_EXECUTOR_STACK_SIZE = 4096;
+// Fewest rows worth handing to a band of their own
+static const int ROW_BAND_MIN_ROWS = 8;
+// Most bands an image operation is split into
+static const int ROW_BANDS_MAX = 32;
+
+/*
+** Runs the bands of rows of an Image operation, set with Image::setExecutor(). Each band counts into its own
+** slot and the slots are merged in band order, so results are the same as when run serially whatever the timing.
+** Without an executor Images run their loops on the calling task as before.
+*/
+class RowExecutor {
+    public:
+        virtual ~RowExecutor() {}
+        // Tasks the bands are spread over, including the caller of run()
+        virtual int workers() const = 0;
+        // Call band(i) for every i from 0 to bands - 1 and return once all have returned. If a band throws, the
+        // bands not yet started are skipped and the first exception is rethrown. Must not be called from within a band
+        virtual void run(int bands, const std::function<void(int)>& band) = 0;
+};
+
+/*
+** Spreads bands over a fixed set of tasks: workers() - 1 std::threads (FreeRTOS tasks on the ESP32) and the
+** caller of run(), each taking the next band until there are none left.
+*/
+class ThreadPool : public RowExecutor {
+    public:
+        // workers includes the caller of run(); 0 means one per core
+        ThreadPool(int workers = 0, size_t stackSize = ROW_EXECUTOR_STACK_SIZE);
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool();
+        int workers() const override { return (int)_threads.size() + 1; }
+        void run(int bands, const std::function<void(int)>& band) override;
+    private:
+        void work();
+        void takeBands();
+        std::mutex _mutex;
+        std::condition_variable _start;     // A run() has bands to take, or the pool is stopping
+        std::condition_variable _idle;      // The last band is done, or a task has stopped taking bands
+        const std::function<void(int)>* _band;
+        int _bands;
+        std::atomic<int> _next;
+        std::atomic<int> _pending;          // Bands of the current run() not yet done
+        int _active;                        // Threads taking bands
+        uint32_t _generation;               // Counts run()s so that each thread joins each one once
+        std::exception_ptr _error;          // First exception thrown by a band of the current run()
+        std::atomic<bool> _failed;          // A band has thrown, so the rest are skipped
+        bool _running;
+        bool _stopping;
+        std::vector<std::thread> _threads;
+};
+#endif
@@ -0,0 +1,105 @@
+#include "esp_image.h"
+
+void IntegralImage::build(Image& image, bool squares) {
+	if (!image.hasContent()) {
+		throw LogicError(StringF("[%s:%d] %s is empty", __FILE__, __LINE__, image.objectName().c_str()));
+	}
+	if ((uint64_t)image.width * image.height * 255 > UINT32_MAX) {
+		throw LogicError(StringF("[%s:%d] %s: %d x %d is too big for an IntegralImage", __FILE__, __LINE__, image.objectName().c_str(), image.width, image.height));
+	}
+	_width = image.width;
+	_height = image.height;
+	size_t stride = _width + 1;
+	_sums.assign(stride * (_height + 1), 0);
+	if (squares) {
+		_squares.assign(stride * (_height + 1), 0);
+	} else {
+		_squares.clear();
+	}
+	std::vector<uint8_t> grey(_width);
+	for (int y = 0; y < _height; y++) {
+		image.greyRow(0, y, _width, grey.data());
+		const uint32_t* above = _sums.data() + y * stride;
+		uint32_t* row = _sums.data() + (y + 1) * stride;
+		uint32_t rowSum = 0;
+		for (int x = 0; x < _width; x++) {
+			rowSum += grey[x];
+			row[x + 1] = above[x + 1] + rowSum;
+		}
+		if (squares) {
+			const uint64_t* squaresAbove = _squares.data() + y * stride;
+			uint64_t* squaresRow = _squares.data() + (y + 1) * stride;
+			uint32_t rowSumOfSquares = 0;
+			for (int x = 0; x < _width; x++) {
+				rowSumOfSquares += (uint32_t)grey[x] * grey[x];
+				squaresRow[x + 1] = squaresAbove[x + 1] + rowSumOfSquares;
+			}
+		}
+	}
+}
+
+// Convert x, y, w, h to the clipped corners x0, y0 (inclusive) to x1, y1 (exclusive)
+bool IntegralImage::clip(int& x0, int& y0, int& x1, int& y1) const {
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > _width) x1 = _width;
+	if (y1 > _height) y1 = _height;
+	return x0 < x1 && y0 < y1;
+}
+
+uint32_t IntegralImage::sum(int x, int y, int w, int h) const {
+	int x1 = x + w, y1 = y + h;
+	if (!clip(x, y, x1, y1)) return 0;
+	size_t stride = _width + 1;
+	return _sums[y1 * stride + x1] - _sums[y * stride + x1] - _sums[y1 * stride + x] + _sums[y * stride + x];
+}
+
+uint64_t IntegralImage::sumOfSquares(int x, int y, int w, int h) const {
+	if (!hasSquares()) {
+		throw LogicError(StringF("[%s:%d] IntegralImage was built without squares", __FILE__, __LINE__));
+	}
+	int x1 = x + w, y1 = y + h;
+	if (!clip(x, y, x1, y1)) return 0;
+	size_t stride = _width + 1;
+	return _squares[y1 * stride + x1] - _squares[y * stride + x1] - _squares[y1 * stride + x] + _squares[y * stride + x];
+}
+
+uint32_t IntegralImage::area(int x, int y, int w, int h) const {
+	int x1 = x + w, y1 = y + h;
+	if (!clip(x, y, x1, y1)) return 0;
+	return (uint32_t)(x1 - x) * (y1 - y);
+}
+
+float IntegralImage::mean(int x, int y, int w, int h) const {
+	uint32_t n = area(x, y, w, h);
+	return n ? (float)sum(x, y, w, h) / n : 0;
+}
+
+float IntegralImage::variance(int x, int y, int w, int h) const {
+	uint32_t n = area(x, y, w, h);
+	if (n == 0) return 0;
+	double m = (double)sum(x, y, w, h) / n;
+	return (double)sumOfSquares(x, y, w, h) / n - m * m;
+}
+
+void IntegralImage::boxFilter(Image& target, int radius) const {
+	if (radius < 0) {
+		throw LogicError(StringF("[%s:%d] Box filter radius must be 0 or more", __FILE__, __LINE__));
+	}
+	uint8_t* out = target.create(IMAGE_GRAYSCALE8, _width, _height);
+	size_t stride = _width + 1;
+	for (int y = 0; y < _height; y++) {
+		int y0 = y - radius < 0 ? 0 : y - radius;
+		int y1 = y + radius + 1 > _height ? _height : y + radius + 1;
+		const uint32_t* top = _sums.data() + y0 * stride;
+		const uint32_t* bottom = _sums.data() + y1 * stride;
+		uint32_t rows = y1 - y0;
+		for (int x = 0; x < _width; x++) {
+			int x0 = x - radius < 0 ? 0 : x - radius;
+			int x1 = x + radius + 1 > _width ? _width : x + radius + 1;
+			uint32_t n = rows * (x1 - x0);
+			uint32_t total = bottom[x1] - top[x1] - bottom[x0] + top[x0];
+			*out++ = (total + n / 2) / n;
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef ESP_IMAGE_INTEGRAL_H
+#define ESP_IMAGE_INTEGRAL_H
+#include <stdint.h>
+#include <stddef.h>
+#include "vector"
+
+class Image;
+
+/*
+** Summed-area table of the grey values of an Image.
+** Once built (one pass over the image) the sum, mean and variance of the grey values in any rectangle
+** cost four lookups, however big the rectangle is.
+** Sums are held as uint32 so images are limited to 16.8M pixels; squared sums (for variance) as uint64.
+*/
+class IntegralImage {
+    public:
+        IntegralImage() : _width(0), _height(0) {};
+        IntegralImage(Image& image, bool squares = false) : IntegralImage() { build(image, squares); }
+        // (Re)build from an RGB565, RGB888, BMP or GRAYSCALE8 image, reusing the tables if the size is unchanged
+        void build(Image& image, bool squares = false);
+        int width() const { return _width; }
+        int height() const { return _height; }
+        bool hasSquares() const { return !_squares.empty(); }
+        // Rectangles are clipped to the image. An empty rectangle has a sum, mean and variance of 0
+        uint32_t sum(int x, int y, int w, int h) const;
+        uint64_t sumOfSquares(int x, int y, int w, int h) const;
+        uint32_t area(int x, int y, int w, int h) const;
+        float mean(int x, int y, int w, int h) const;
+        float variance(int x, int y, int w, int h) const;
+        // Replace target with the GRAYSCALE8 mean of the (2 * radius + 1) square around each pixel
+        void boxFilter(Image& target, int radius) const;
+    private:
+        bool clip(int& x0, int& y0, int& x1, int& y1) const;
+        int _width;
+        int _height;
+        // (width + 1) x (height + 1) with a zero first row and column so no lookup needs a bounds check
+        std::vector<uint32_t> _sums;
+        std::vector<uint64_t> _squares;
+};
+#endif
@@ -0,0 +1,441 @@
+#include "esp_image_kernels.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ESP_IMAGE_NO_SIMD builds the portable kernels the ESP32 runs on any host, so that they can be tested there
+#if defined(__SSE2__) && !defined(ESP_IMAGE_NO_SIMD)
+#define ESP_IMAGE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && !defined(ESP_IMAGE_NO_SIMD)
+#define ESP_IMAGE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace image_kernels {
+
+// R = 306 / 1024, G = 600 / 1024, B = 117 / 1024 as in Pixel::grey()
+// The high byte holds R and the top 3 bits of G, the low byte the bottom 3 bits of G and B
+GreyTables::GreyTables() {
+    for (int i = 0; i < 256; i++) {
+        hi[i] = (uint32_t)(i & 0xF8) * 306 + (uint32_t)((i & 0x07) << 5) * 600;
+        lo[i] = (uint32_t)((i & 0xE0) >> 3) * 600 + (uint32_t)((i & 0x1F) << 3) * 117;
+    }
+}
+const GreyTables greyTables;
+
+// The RGB565 kernels are written once for both pixel orders. Native is little-endian, as on the ESP32 and the hosts
+template<bool Native>
+static inline uint16_t rgb565Value(const uint8_t* p) {
+    if (Native) {
+        uint16_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+    return p[0] << 8 | p[1];
+}
+
+template<bool Native>
+static inline uint8_t greyOf(const uint8_t* p) {
+    return Native ? rgb565GreyNative(rgb565Value<true>(p)) : rgb565Grey(p);
+}
+
+template<bool Native>
+static int countGreyDiffsScalar(const uint8_t* a, const uint8_t* b, int count, int stride, int threshold) {
+    int diffs = 0;
+    int step = 2 * stride;
+    for (int i = 0; i < count; i++, a += step, b += step) {
+        diffs += abs((int)greyOf<Native>(a) - (int)greyOf<Native>(b)) > threshold ? 1 : 0;
+    }
+    return diffs;
+}
+
+static int countByteDiffsScalar(const uint8_t* a, const uint8_t* b, int count, int stride, int threshold) {
+    int diffs = 0;
+    for (int i = 0; i < count; i++, a += stride, b += stride) {
+        diffs += abs((int)*a - (int)*b) > threshold ? 1 : 0;
+    }
+    return diffs;
+}
+
+#if defined(ESP_IMAGE_SSE2)
+static inline __m128i swapBytes(__m128i v) {
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+// Grey values of 8 RGB565 pixels as 16 bit lanes
+template<bool Native>
+static inline __m128i greyOf8(const uint8_t* p) {
+    const __m128i raw = _mm_loadu_si128((const __m128i*)p);
+    const __m128i v = Native ? raw : swapBytes(raw);
+    const __m128i r = _mm_and_si128(_mm_srli_epi16(v, 8), _mm_set1_epi16(0xF8));
+    const __m128i g = _mm_and_si128(_mm_srli_epi16(v, 3), _mm_set1_epi16(0xFC));
+    const __m128i b = _mm_and_si128(_mm_slli_epi16(v, 3), _mm_set1_epi16(0xF8));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgWeights = _mm_set1_epi32(600 << 16 | 306);
+    const __m128i bWeight = _mm_set1_epi32(117);
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), rgWeights), _mm_madd_epi16(_mm_unpacklo_epi16(b, zero), bWeight));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), rgWeights), _mm_madd_epi16(_mm_unpackhi_epi16(b, zero), bWeight));
+    return _mm_packs_epi32(_mm_srli_epi32(lo, 10), _mm_srli_epi32(hi, 10));
+}
+
+static inline int sumLanes(__m128i acc) {
+    __m128i sum = _mm_madd_epi16(acc, _mm_set1_epi16(1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+template<bool Native>
+static int countGreyDiffsContiguous(const uint8_t* a, const uint8_t* b, int count, int threshold) {
+    const __m128i limit = _mm_set1_epi16(threshold < -1 ? -1 : threshold > 255 ? 255 : threshold);
+    __m128i acc = _mm_setzero_si128();
+    int diffs = 0;
+    int pending = 0;
+    int i = 0;
+    for (; i + 8 <= count; i += 8, a += 16, b += 16) {
+        __m128i d = _mm_sub_epi16(greyOf8<Native>(a), greyOf8<Native>(b));
+        d = _mm_max_epi16(d, _mm_sub_epi16(_mm_setzero_si128(), d));
+        // Lanes that differ are all ones, i.e. -1, so subtracting counts them
+        acc = _mm_sub_epi16(acc, _mm_cmpgt_epi16(d, limit));
+        if (++pending == 0x7FFF) {
+            pending = 0;
+            diffs += sumLanes(acc);
+            acc = _mm_setzero_si128();
+        }
+    }
+    return diffs + sumLanes(acc) + countGreyDiffsScalar<Native>(a, b, count - i, 1, threshold);
+}
+
+static int countByteDiffsContiguous(const uint8_t* a, const uint8_t* b, int count, int threshold) {
+    if (threshold < 0) return count;
+    if (threshold > 254) return 0;
+    const __m128i limit = _mm_set1_epi8((char)threshold);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    __m128i total = zero;
+    int pending = 0;
+    int i = 0;
+    for (; i + 16 <= count; i += 16, a += 16, b += 16) {
+        const __m128i va = _mm_loadu_si128((const __m128i*)a);
+        const __m128i vb = _mm_loadu_si128((const __m128i*)b);
+        const __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        // Lanes within the threshold saturate to 0, so the others differ
+        const __m128i same = _mm_cmpeq_epi8(_mm_subs_epu8(d, limit), zero);
+        acc = _mm_add_epi8(acc, _mm_andnot_si128(same, _mm_set1_epi8(1)));
+        if (++pending == 255) {
+            pending = 0;
+            total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+            acc = zero;
+        }
+    }
+    total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+    int diffs = _mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(total, total));
+    return diffs + countByteDiffsScalar(a, b, count - i, 1, threshold);
+}
+#elif defined(ESP_IMAGE_NEON)
+template<bool Native>
+static inline uint16x8_t greyOf8(const uint8_t* p) {
+    const uint8x16_t raw = vld1q_u8(p);
+    const uint16x8_t v = vreinterpretq_u16_u8(Native ? raw : vrev16q_u8(raw));
+    const uint16x8_t r = vandq_u16(vshrq_n_u16(v, 8), vdupq_n_u16(0xF8));
+    const uint16x8_t g = vandq_u16(vshrq_n_u16(v, 3), vdupq_n_u16(0xFC));
+    const uint16x8_t b = vandq_u16(vshlq_n_u16(v, 3), vdupq_n_u16(0xF8));
+    uint32x4_t lo = vmull_n_u16(vget_low_u16(r), 306);
+    lo = vmlal_n_u16(lo, vget_low_u16(g), 600);
+    lo = vmlal_n_u16(lo, vget_low_u16(b), 117);
+    uint32x4_t hi = vmull_n_u16(vget_high_u16(r), 306);
+    hi = vmlal_n_u16(hi, vget_high_u16(g), 600);
+    hi = vmlal_n_u16(hi, vget_high_u16(b), 117);
+    return vcombine_u16(vshrn_n_u32(lo, 10), vshrn_n_u32(hi, 10));
+}
+
+template<bool Native>
+static int countGreyDiffsContiguous(const uint8_t* a, const uint8_t* b, int count, int threshold) {
+    if (threshold < 0) return count;
+    const uint16x8_t limit = vdupq_n_u16(threshold > 255 ? 255 : threshold);
+    uint16x8_t acc = vdupq_n_u16(0);
+    int diffs = 0;
+    int pending = 0;
+    int i = 0;
+    for (; i + 8 <= count; i += 8, a += 16, b += 16) {
+        // Lanes that differ are all ones, i.e. -1, so subtracting counts them
+        acc = vsubq_u16(acc, vcgtq_u16(vabdq_u16(greyOf8<Native>(a), greyOf8<Native>(b)), limit));
+        if (++pending == 0xFFFF) {
+            pending = 0;
+            uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(acc));
+            diffs += vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+            acc = vdupq_n_u16(0);
+        }
+    }
+    uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(acc));
+    diffs += vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+    return diffs + countGreyDiffsScalar<Native>(a, b, count - i, 1, threshold);
+}
+
+static int countByteDiffsContiguous(const uint8_t* a, const uint8_t* b, int count, int threshold) {
+    if (threshold < 0) return count;
+    if (threshold > 254) return 0;
+    const uint8x16_t limit = vdupq_n_u8(threshold);
+    uint8x16_t acc = vdupq_n_u8(0);
+    int diffs = 0;
+    int pending = 0;
+    int i = 0;
+    for (; i + 16 <= count; i += 16, a += 16, b += 16) {
+        acc = vsubq_u8(acc, vcgtq_u8(vabdq_u8(vld1q_u8(a), vld1q_u8(b)), limit));
+        if (++pending == 255) {
+            pending = 0;
+            uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(acc)));
+            diffs += vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+            acc = vdupq_n_u8(0);
+        }
+    }
+    uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(acc)));
+    diffs += vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+    return diffs + countByteDiffsScalar(a, b, count - i, 1, threshold);
+}
+#else
+// No SIMD on the ESP32's Xtensa cores, but a 32 bit word still holds two pixels or four bytes. Values are worked on
+// in its two 16 bit lanes, which leave room for the borrow of a - b and the carry of adding the limit
+static const uint32_t LANE_LOW = 0x00FF00FF;
+static const uint32_t LANE_BIAS = 0x01000100;   // 256 in each lane, so that a - b never borrows from the lane above
+static const uint32_t LANE_HIT = 0x02000200;    // Bit 9 of each lane
+
+// The helpers are forced inline as the ESP32 core builds with -Os, which would leave them as calls in the loops.
+// Word loads need 4 byte alignment on the ESP32, which callers line up first
+static inline __attribute__((always_inline)) uint32_t loadWord(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, __builtin_assume_aligned(p, 4), sizeof(value));
+    return value;
+}
+
+static inline bool wordAligned(const uint8_t* p) {
+    return ((uintptr_t)p & 3) == 0;
+}
+
+// LANE_HIT for each lane where x and y (both below 256) differ by more than threshold, limit being 255 - threshold
+// in each lane. 256 + x - y + limit reaches 512 exactly when x - y > threshold, and stays below 1024
+static inline __attribute__((always_inline)) uint32_t laneDiffs(uint32_t x, uint32_t y, uint32_t limit) {
+    return ((((x | LANE_BIAS) - y) + limit) | (((y | LANE_BIAS) - x) + limit)) & LANE_HIT;
+}
+
+// Grey values of the two RGB565 pixels of the little-endian word v, one per lane. With 5, 6 and 5 bit r, g and b
+// the Pixel::grey() sum is 8 * (r * 306 + g * 300 + b * 117), and the bracket is below 32768 so it fits a lane.
+// In camera order each lane holds the low byte (bottom 3 bits of g, then b) above the high byte (r, top 3 bits of g)
+template<bool Native>
+static inline __attribute__((always_inline)) uint32_t greyOf2(uint32_t v) {
+    const uint32_t r = Native ? (v >> 11) & 0x001F001F : (v >> 3) & 0x001F001F;
+    const uint32_t g = Native ? (v >> 5) & 0x003F003F : ((v << 3) & 0x00380038) | ((v >> 13) & 0x00070007);
+    const uint32_t b = Native ? v & 0x001F001F : (v >> 8) & 0x001F001F;
+    return ((r * 306 + g * 300 + b * 117) >> 7) & LANE_LOW;
+}
+
+static inline int sumLanes(uint32_t acc) {
+    return (acc & 0xFFFF) + (acc >> 16);
+}
+
+template<bool Native>
+static int countGreyDiffsContiguous(const uint8_t* a, const uint8_t* b, int count, int threshold) {
+    if (threshold < 0) return count;
+    if (threshold > 254) return 0;
+    if (((uintptr_t)a & 3) != ((uintptr_t)b & 3) || ((uintptr_t)a & 1)) {
+        return countGreyDiffsScalar<Native>(a, b, count, 1, threshold);
+    }
+    int diffs = 0;
+    if (!wordAligned(a) && count > 0) {
+        diffs += countGreyDiffsScalar<Native>(a, b, 1, 1, threshold);
+        a += 2;
+        b += 2;
+        count--;
+    }
+    const uint32_t limit = (uint32_t)(255 - threshold) * 0x00010001;
+    uint32_t acc = 0;
+    int pending = 0;
+    int i = 0;
+    for (; i + 2 <= count; i += 2, a += 4, b += 4) {
+        acc += laneDiffs(greyOf2<Native>(loadWord(a)), greyOf2<Native>(loadWord(b)), limit) >> 9;
+        if (++pending == 0xFFFF) {
+            pending = 0;
+            diffs += sumLanes(acc);
+            acc = 0;
+        }
+    }
+    return diffs + sumLanes(acc) + countGreyDiffsScalar<Native>(a, b, count - i, 1, threshold);
+}
+
+static int countByteDiffsContiguous(const uint8_t* a, const uint8_t* b, int count, int threshold) {
+    if (threshold < 0) return count;
+    if (threshold > 254) return 0;
+    if (((uintptr_t)a & 3) != ((uintptr_t)b & 3)) {
+        return countByteDiffsScalar(a, b, count, 1, threshold);
+    }
+    int diffs = 0;
+    while (!wordAligned(a) && count > 0) {
+        diffs += countByteDiffsScalar(a++, b++, 1, 1, threshold);
+        count--;
+    }
+    const uint32_t limit = (uint32_t)(255 - threshold) * 0x00010001;
+    uint32_t acc = 0;
+    int pending = 0;
+    int i = 0;
+    for (; i + 4 <= count; i += 4, a += 4, b += 4) {
+        const uint32_t va = loadWord(a);
+        const uint32_t vb = loadWord(b);
+        // Even bytes, then odd bytes, each up to one LANE_HIT per lane
+        acc += (laneDiffs(va & LANE_LOW, vb & LANE_LOW, limit) + laneDiffs(va >> 8 & LANE_LOW, vb >> 8 & LANE_LOW, limit)) >> 9;
+        if (++pending == 0x7FFF) {
+            pending = 0;
+            diffs += sumLanes(acc);
+            acc = 0;
+        }
+    }
+    return diffs + sumLanes(acc) + countByteDiffsScalar(a, b, count - i, 1, threshold);
+}
+#endif
+
+int countGreyDiffs(const uint8_t* a, const uint8_t* b, int count, int stride, int threshold) {
+    if (stride == 1) {
+        return countGreyDiffsContiguous<false>(a, b, count, threshold);
+    }
+    return countGreyDiffsScalar<false>(a, b, count, stride, threshold);
+}
+
+int countGreyDiffsNative(const uint8_t* a, const uint8_t* b, int count, int stride, int threshold) {
+    if (stride == 1) {
+        return countGreyDiffsContiguous<true>(a, b, count, threshold);
+    }
+    return countGreyDiffsScalar<true>(a, b, count, stride, threshold);
+}
+
+int countByteDiffs(const uint8_t* a, const uint8_t* b, int count, int stride, int threshold) {
+    if (stride == 1) {
+        return countByteDiffsContiguous(a, b, count, threshold);
+    }
+    return countByteDiffsScalar(a, b, count, stride, threshold);
+}
+
+template<bool Native>
+static void rgb565ToBgrOrder(const uint8_t* src, uint8_t* dst, int count) {
+    for (int i = 0; i < count; i++, src += 2, dst += 3) {
+        uint16_t value = rgb565Value<Native>(src);
+        dst[0] = (value & 0x1F) << 3;
+        dst[1] = (value >> 3) & 0xFC;
+        dst[2] = (value >> 8) & 0xF8;
+    }
+}
+
+template<bool Native>
+static void bgrToRgb565Order(const uint8_t* src, uint8_t* dst, int count) {
+    for (int i = 0; i < count; i++, src += 3, dst += 2) {
+        int b = (src[0] + 4) >> 3;
+        int g = (src[1] + 2) >> 2;
+        int r = (src[2] + 4) >> 3;
+        if (b > 31) b = 31;
+        if (g > 63) g = 63;
+        if (r > 31) r = 31;
+        uint16_t value = r << 11 | g << 5 | b;
+        if (Native) {
+            memcpy(dst, &value, sizeof(value));
+        } else {
+            dst[0] = value >> 8;
+            dst[1] = value & 0xFF;
+        }
+    }
+}
+
+template<bool Native>
+static void rgb565ToGreyOrder(const uint8_t* src, uint8_t* dst, int count) {
+    int i = 0;
+#if defined(ESP_IMAGE_SSE2)
+    for (; i + 8 <= count; i += 8, src += 16) {
+        const __m128i grey = greyOf8<Native>(src);
+        _mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(grey, grey));
+    }
+#elif defined(ESP_IMAGE_NEON)
+    for (; i + 8 <= count; i += 8, src += 16) {
+        vst1_u8(dst + i, vmovn_u16(greyOf8<Native>(src)));
+    }
+#endif
+    for (; i < count; i++, src += 2) {
+        dst[i] = greyOf<Native>(src);
+    }
+}
+
+void rgb565ToBgr(const uint8_t* src, uint8_t* dst, int count) {
+    rgb565ToBgrOrder<false>(src, dst, count);
+}
+
+void rgb565ToBgrNative(const uint8_t* src, uint8_t* dst, int count) {
+    rgb565ToBgrOrder<true>(src, dst, count);
+}
+
+void bgrToRgb565(const uint8_t* src, uint8_t* dst, int count) {
+    bgrToRgb565Order<false>(src, dst, count);
+}
+
+void bgrToRgb565Native(const uint8_t* src, uint8_t* dst, int count) {
+    bgrToRgb565Order<true>(src, dst, count);
+}
+
+void rgb565ToGrey(const uint8_t* src, uint8_t* dst, int count) {
+    rgb565ToGreyOrder<false>(src, dst, count);
+}
+
+void rgb565ToGreyNative(const uint8_t* src, uint8_t* dst, int count) {
+    rgb565ToGreyOrder<true>(src, dst, count);
+}
+
+void bgrToGrey(const uint8_t* src, uint8_t* dst, int count) {
+    for (int i = 0; i < count; i++, src += 3) {
+        dst[i] = rgbGrey(src[2], src[1], src[0]);
+    }
+}
+
+// A grey value packs to the same RGB565 pixel as bgrToRgb565() would give for B = G = R
+GreyRgb565Table::GreyRgb565Table() {
+    for (int i = 0; i < 256; i++) {
+        uint8_t bgr[3] = { (uint8_t)i, (uint8_t)i, (uint8_t)i };
+        bgrToRgb565(bgr, pixel[i], 1);
+        bgrToRgb565Native(bgr, (uint8_t*)&native[i], 1);
+    }
+}
+const GreyRgb565Table greyRgb565Table;
+
+void greyToRgb565(const uint8_t* src, uint8_t* dst, int count) {
+    for (int i = 0; i < count; i++, dst += 2) {
+        const uint8_t* p = greyRgb565Table.pixel[src[i]];
+        dst[0] = p[0];
+        dst[1] = p[1];
+    }
+}
+
+void greyToRgb565Native(const uint8_t* src, uint8_t* dst, int count) {
+    for (int i = 0; i < count; i++, dst += 2) {
+        memcpy(dst, &greyRgb565Table.native[src[i]], 2);
+    }
+}
+
+void swapRgb565(const uint8_t* src, uint8_t* dst, int count) {
+    int i = 0;
+#if defined(ESP_IMAGE_SSE2)
+    for (; i + 8 <= count; i += 8, src += 16, dst += 16) {
+        _mm_storeu_si128((__m128i*)dst, swapBytes(_mm_loadu_si128((const __m128i*)src)));
+    }
+#elif defined(ESP_IMAGE_NEON)
+    for (; i + 8 <= count; i += 8, src += 16, dst += 16) {
+        vst1q_u8(dst, vrev16q_u8(vld1q_u8(src)));
+    }
+#endif
+    for (; i < count; i++, src += 2, dst += 2) {
+        uint8_t hi = src[0];
+        dst[0] = src[1];
+        dst[1] = hi;
+    }
+}
+
+void greyToBgr(const uint8_t* src, uint8_t* dst, int count) {
+    for (int i = 0; i < count; i++, dst += 3) {
+        dst[0] = dst[1] = dst[2] = src[i];
+    }
+}
+
+} // namespace image_kernels
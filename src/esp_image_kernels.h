@@ -0,0 +1,78 @@
+#ifndef ESP_IMAGE_KERNELS_H
+#define ESP_IMAGE_KERNELS_H
+/*
+** Row kernels shared by the Image methods
+** These work on raw buffers and do no bounds or type checking - that is the caller's job.
+** RGB565 pointers are in the big-endian (camera) byte order unless the kernel name ends in Native.
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+// Byte order of RGB565 pixels in memory. The esp32-camera driver delivers them big-endian, so each access has to
+// swap the bytes. In native order (little-endian on the ESP32) a pixel can be loaded directly as a uint16_t
+typedef enum {
+    PIXEL_ORDER_CAMERA,
+    PIXEL_ORDER_NATIVE
+} pixel_order_t;
+
+namespace image_kernels {
+
+// Grey value of an RGB565 pixel split by byte so it can be looked up rather than unpacked.
+// greyHi[hi] + greyLo[lo] is exactly the weighted sum used by Pixel::grey() before the >> 10
+struct GreyTables {
+    GreyTables();
+    uint32_t hi[256];
+    uint32_t lo[256];
+};
+extern const GreyTables greyTables;
+
+inline uint8_t rgb565Grey(const uint8_t* p) {
+    return (greyTables.hi[p[0]] + greyTables.lo[p[1]]) >> 10;
+}
+
+inline uint8_t rgb565GreyNative(uint16_t value) {
+    return (greyTables.hi[value >> 8] + greyTables.lo[value & 0xFF]) >> 10;
+}
+
+// Number of the 'count' pixels (each 'stride' pixels apart) whose grey values differ by more than threshold
+int countGreyDiffs(const uint8_t* a, const uint8_t* b, int count, int stride, int threshold);
+int countGreyDiffsNative(const uint8_t* a, const uint8_t* b, int count, int stride, int threshold);
+
+// As countGreyDiffs() for GRAYSCALE8 pixels
+int countByteDiffs(const uint8_t* a, const uint8_t* b, int count, int stride, int threshold);
+
+// Luma of an RGB888 pixel with the Pixel::grey() weights
+inline uint8_t rgbGrey(uint8_t r, uint8_t g, uint8_t b) {
+    return ((uint32_t)r * 306 + (uint32_t)g * 600 + (uint32_t)b * 117) >> 10;
+}
+
+// RGB565 to and from 8 bit B, G, R (the in-memory order of RGB888). Each 5 or 6 bit value is shifted
+// up as in Pixel, and rounded back down on the way back so unpack then pack is lossless
+void rgb565ToBgr(const uint8_t* src, uint8_t* dst, int count);
+void rgb565ToBgrNative(const uint8_t* src, uint8_t* dst, int count);
+void bgrToRgb565(const uint8_t* src, uint8_t* dst, int count);
+void bgrToRgb565Native(const uint8_t* src, uint8_t* dst, int count);
+
+// Grey values of a row of pixels
+void rgb565ToGrey(const uint8_t* src, uint8_t* dst, int count);
+void rgb565ToGreyNative(const uint8_t* src, uint8_t* dst, int count);
+void bgrToGrey(const uint8_t* src, uint8_t* dst, int count);
+
+// RGB565 pixel for each grey value, big-endian and native
+struct GreyRgb565Table {
+    GreyRgb565Table();
+    uint8_t pixel[256][2];
+    uint16_t native[256];
+};
+extern const GreyRgb565Table greyRgb565Table;
+
+// Grey values expanded to RGB565 or to 8 bit B, G, R
+void greyToRgb565(const uint8_t* src, uint8_t* dst, int count);
+void greyToRgb565Native(const uint8_t* src, uint8_t* dst, int count);
+void greyToBgr(const uint8_t* src, uint8_t* dst, int count);
+
+// Convert count RGB565 pixels between camera and native order. src and dst may be the same buffer
+void swapRgb565(const uint8_t* src, uint8_t* dst, int count);
+
+} // namespace image_kernels
+#endif
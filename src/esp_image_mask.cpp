@@ -0,0 +1,109 @@
+#include "esp_image.h"
+#include "algorithm"
+
+// Evaluate the mask function once per pixel and keep only the runs of included pixels
+Mask::Mask(int width, int height, maskFunction maskFunc) :
+	_width(width),
+	_height(height),
+	_rowIndex(1, 0) {
+	if (width < 0 || width > 0xFFFF || height < 0 || height > 0xFFFF) {
+		throw LogicError(StringF("[%s:%d] Mask size %d x %d is out of range", __FILE__, __LINE__, width, height));
+	}
+	_rowIndex.reserve(height + 1);
+	for (int y = 0; y < height; y++) {
+		int start = -1;
+		for (int x = 0; x < width; x++) {
+			bool included = maskFunc == nullptr || maskFunc(x, y, width, height);
+			if (included && start < 0) {
+				start = x;
+			} else
+			if (!included && start >= 0) {
+				addSpan(start, x);
+				start = -1;
+			}
+		}
+		if (start >= 0) addSpan(start, width);
+		endRow();
+	}
+}
+
+bool Mask::contains(int x, int y) const {
+	if (x < 0 || x >= _width || y < 0 || y >= _height) return false;
+	for (const Span* span = rowBegin(y); span != rowEnd(y); span++) {
+		if (x < span->start) return false;
+		if (x < span->end) return true;
+	}
+	return false;
+}
+
+size_t Mask::count() const {
+	size_t total = 0;
+	for (auto& span : _spans) {
+		total += span.end - span.start;
+	}
+	return total;
+}
+
+Mask Mask::operator|(const Mask& that) const {
+	return combine(that, false);
+}
+
+Mask Mask::operator&(const Mask& that) const {
+	return combine(that, true);
+}
+
+Mask Mask::operator~() const {
+	Mask result;
+	result._width = _width;
+	result._height = _height;
+	for (int y = 0; y < _height; y++) {
+		int x = 0;
+		for (const Span* span = rowBegin(y); span != rowEnd(y); span++) {
+			if (span->start > x) result.addSpan(x, span->start);
+			x = span->end;
+		}
+		if (x < _width) result.addSpan(x, _width);
+		result.endRow();
+	}
+	return result;
+}
+
+// Merge the sorted span lists of each row
+Mask Mask::combine(const Mask& that, bool intersect) const {
+	if (_width != that._width || _height != that._height) {
+		throw LogicError(StringF("[%s:%d] Cannot combine a %d x %d Mask with a %d x %d Mask", __FILE__, __LINE__, _width, _height, that._width, that._height));
+	}
+	Mask result;
+	result._width = _width;
+	result._height = _height;
+	for (int y = 0; y < _height; y++) {
+		const Span* a = rowBegin(y);
+		const Span* aEnd = rowEnd(y);
+		const Span* b = that.rowBegin(y);
+		const Span* bEnd = that.rowEnd(y);
+		if (intersect) {
+			while (a != aEnd && b != bEnd) {
+				int start = std::max(a->start, b->start);
+				int end = std::min(a->end, b->end);
+				if (start < end) result.addSpan(start, end);
+				if (a->end < b->end) a++; else b++;
+			}
+		} else {
+			int start = -1;
+			int end = -1;
+			while (a != aEnd || b != bEnd) {
+				const Span* next = (b == bEnd || (a != aEnd && a->start <= b->start)) ? a++ : b++;
+				if (start >= 0 && next->start <= end) {
+					end = std::max(end, (int)next->end);
+				} else {
+					if (start >= 0) result.addSpan(start, end);
+					start = next->start;
+					end = next->end;
+				}
+			}
+			if (start >= 0) result.addSpan(start, end);
+		}
+		result.endRow();
+	}
+	return result;
+}
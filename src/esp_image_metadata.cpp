@@ -0,0 +1,211 @@
+#include "esp_image_metadata.h"
+#include "utility"
+
+namespace metadata_json {
+
+static const char hexDigits[] = "0123456789abcdef";
+
+// Copy runs of plain characters in one go and escape the rest
+static void writeString(const String& s, String& out) {
+	const char* p = s.c_str();
+	const char* end = p + s.length();
+	out.concat('"');
+	while (p < end) {
+		const char* run = p;
+		while (p < end && *p != '"' && *p != '\\' && (uint8_t)*p >= 0x20) p++;
+		if (p > run) out.concat(run, p - run);
+		if (p == end) break;
+		char escape[7] = { '\\', *p, 0 };
+		switch (*p) {
+			case '"':
+			case '\\':
+				break;
+			case '\n': escape[1] = 'n'; break;
+			case '\r': escape[1] = 'r'; break;
+			case '\t': escape[1] = 't'; break;
+			case '\b': escape[1] = 'b'; break;
+			case '\f': escape[1] = 'f'; break;
+			default:
+				escape[1] = 'u';
+				escape[2] = '0';
+				escape[3] = '0';
+				escape[4] = hexDigits[(uint8_t)*p >> 4];
+				escape[5] = hexDigits[*p & 0x0F];
+		}
+		out.concat(escape, escape[1] == 'u' ? 6 : 2);
+		p++;
+	}
+	out.concat('"');
+}
+
+void write(const std::map<String, String>& metadata, String& out) {
+	size_t needed = 32;
+	for (auto& el : metadata) {
+		needed += el.first.length() + el.second.length() + 40;
+	}
+	out.reserve(out.length() + needed);
+	out += "{ \"metadata\" : [";
+	bool first = true;
+	for (auto& el : metadata) {
+		if (!first) out += ",\n";
+		first = false;
+		out += "{ \"label\": ";
+		writeString(el.first, out);
+		out += ", \"value\": ";
+		writeString(el.second, out);
+		out += " }";
+	}
+	out += "\n]\n}";
+}
+
+// Single pass recursive descent over the buffer. Nothing is copied except the decoded strings
+class Parser {
+	public:
+		Parser(const char* json, size_t len) : _p(json), _start(json), _end(json + len) {}
+		bool parse(std::map<String, String>& metadata);
+		size_t offset() const { return _p - _start; }
+	private:
+		void skipSpace() {
+			while (_p < _end && (*_p == ' ' || *_p == '\n' || *_p == '\r' || *_p == '\t')) _p++;
+		}
+		bool expect(char c) {
+			skipSpace();
+			if (_p == _end || *_p != c) return false;
+			_p++;
+			return true;
+		}
+		bool peek(char c) {
+			skipSpace();
+			return _p < _end && *_p == c;
+		}
+		bool string(String& s);
+		bool hex4(uint32_t& code);
+		bool entry(std::map<String, String>& metadata);
+		const char* _p;
+		const char* _start;
+		const char* _end;
+		// Reused for every entry
+		String _key;
+		String _label;
+		String _value;
+};
+
+bool Parser::hex4(uint32_t& code) {
+	if (_end - _p < 4) return false;
+	code = 0;
+	for (int i = 0; i < 4; i++, _p++) {
+		char c = *_p;
+		int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+		if (digit < 0) return false;
+		code = code << 4 | digit;
+	}
+	return true;
+}
+
+bool Parser::string(String& s) {
+	if (!expect('"')) return false;
+	s = "";
+	while (_p < _end) {
+		const char* run = _p;
+		while (_p < _end && *_p != '"' && *_p != '\\' && (uint8_t)*_p >= 0x20) _p++;
+		if (_p > run) s.concat(run, _p - run);
+		if (_p == _end || (uint8_t)*_p < 0x20) return false;
+		if (*_p++ == '"') return true;
+		if (_p == _end) return false;
+		char c = *_p++;
+		switch (c) {
+			case '"':
+			case '\\':
+			case '/': s.concat(c); break;
+			case 'n': s.concat('\n'); break;
+			case 'r': s.concat('\r'); break;
+			case 't': s.concat('\t'); break;
+			case 'b': s.concat('\b'); break;
+			case 'f': s.concat('\f'); break;
+			case 'u': {
+				uint32_t code;
+				if (!hex4(code)) return false;
+				if (code >= 0xD800 && code < 0xDC00) {
+					// The high half of a surrogate pair must be followed by the low half
+					uint32_t low;
+					if (_end - _p < 2 || _p[0] != '\\' || _p[1] != 'u') return false;
+					_p += 2;
+					if (!hex4(low) || low < 0xDC00 || low >= 0xE000) return false;
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				}
+				// Back to UTF-8
+				char utf8[4];
+				int n;
+				if (code < 0x80) {
+					utf8[0] = code;
+					n = 1;
+				} else
+				if (code < 0x800) {
+					utf8[0] = 0xC0 | code >> 6;
+					utf8[1] = 0x80 | (code & 0x3F);
+					n = 2;
+				} else
+				if (code < 0x10000) {
+					utf8[0] = 0xE0 | code >> 12;
+					utf8[1] = 0x80 | (code >> 6 & 0x3F);
+					utf8[2] = 0x80 | (code & 0x3F);
+					n = 3;
+				} else {
+					utf8[0] = 0xF0 | code >> 18;
+					utf8[1] = 0x80 | (code >> 12 & 0x3F);
+					utf8[2] = 0x80 | (code >> 6 & 0x3F);
+					utf8[3] = 0x80 | (code & 0x3F);
+					n = 4;
+				}
+				s.concat(utf8, n);
+				break;
+			}
+			default:
+				_p--;
+				return false;
+		}
+	}
+	return false;
+}
+
+// { "label": "...", "value": "..." } in either order. Other string members are ignored
+bool Parser::entry(std::map<String, String>& metadata) {
+	if (!expect('{')) return false;
+	bool hasLabel = false, hasValue = false;
+	if (!peek('}')) {
+		do {
+			if (!string(_key) || !expect(':')) return false;
+			// Decode each member straight into where it is kept
+			bool isLabel = _key == "label";
+			bool isValue = _key == "value";
+			if (!string(isLabel ? _label : isValue ? _value : _key)) return false;
+			hasLabel |= isLabel;
+			hasValue |= isValue;
+		} while (expect(','));
+	}
+	if (!expect('}') || !hasLabel || !hasValue) return false;
+	metadata[_label] = std::move(_value);
+	return true;
+}
+
+bool Parser::parse(std::map<String, String>& metadata) {
+	if (!expect('{') || !string(_key) || _key != "metadata" || !expect(':') || !expect('[')) return false;
+	if (!peek(']')) {
+		do {
+			if (!entry(metadata)) return false;
+			expect(',');  // Optional, older files have none
+		} while (!peek(']'));
+	}
+	if (!expect(']') || !expect('}')) return false;
+	skipSpace();
+	return _p == _end;
+}
+
+bool parse(const char* json, size_t len, std::map<String, String>& metadata, size_t& errorAt) {
+	Parser parser(json, len);
+	if (parser.parse(metadata)) return true;
+	errorAt = parser.offset();
+	return false;
+}
+
+}
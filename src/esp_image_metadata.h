@@ -0,0 +1,26 @@
+#ifndef ESP_IMAGE_METADATA_H
+#define ESP_IMAGE_METADATA_H
+#include <Arduino.h>
+#include "map"
+
+/*
+** Reader and writer for the JSON that holds Image metadata, e.g. in the foo.json sidecar of foo.jpg:
+**   { "metadata" : [{ "label": "size", "value": "640x480" },
+**   { "label": "pattern", "value": "scene" }
+**   ]
+**   }
+** Labels and values are JSON strings so quotes, backslashes and control characters are escaped.
+** Files written before escaping was added (no commas between entries) still parse.
+*/
+namespace metadata_json {
+
+// Append the JSON for metadata to out in one pass, reserving space for it first
+void write(const std::map<String, String>& metadata, String& out);
+
+// Parse json (which need not be terminated) in one pass, adding its entries to metadata.
+// Returns false, with the offset of the first bad character in errorAt, if it is malformed
+bool parse(const char* json, size_t len, std::map<String, String>& metadata, size_t& errorAt);
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include "esp_image_pool.h"
+
+// Never destroyed so that Images destroyed during static destruction can still release into it
+ImageBufferPool& ImageBufferPool::instance() {
+	static ImageBufferPool* pool = new ImageBufferPool();
+	return *pool;
+}
+
+void ImageBufferPool::enable(size_t maxIdleBytes) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_maxIdleBytes = maxIdleBytes;
+}
+
+void ImageBufferPool::disable() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_maxIdleBytes = 0;
+	freeIdle();
+}
+
+// Round up to a 256 byte multiple for small buffers, otherwise to 1/16 of the enclosing power of two
+size_t ImageBufferPool::sizeClass(size_t len) {
+	if (len <= 4096) {
+		return (len + 255) & ~(size_t)255;
+	}
+	size_t power = 4096;
+	while (power < len) power <<= 1;
+	size_t step = power / 16;
+	return (len + step - 1) / step * step;
+}
+
+uint8_t* ImageBufferPool::acquire(size_t len, size_t& size) {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_maxIdleBytes > 0) {
+			auto found = _idle.find(sizeClass(len));
+			if (found != _idle.end()) {
+				auto& list = found->second;
+				for (size_t i = 0; i < list.size(); i++) {
+					// Buffers adopted from elsewhere may be smaller than their class
+					if (list[i].size >= len) {
+						uint8_t* buffer = list[i].buffer;
+						size = list[i].size;
+						list[i] = list.back();
+						list.pop_back();
+						_stats.idleBuffers--;
+						_stats.idleBytes -= size;
+						_stats.hits++;
+						return buffer;
+					}
+				}
+			}
+			size = sizeClass(len);
+		} else {
+			size = len;
+		}
+		_stats.misses++;
+	}
+	return new uint8_t[size];
+}
+
+void ImageBufferPool::release(uint8_t* buffer, size_t size) {
+	if (buffer == nullptr) return;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_maxIdleBytes > 0 && _stats.idleBytes + size <= _maxIdleBytes) {
+			_idle[sizeClass(size)].push_back({ buffer, size });
+			_stats.idleBuffers++;
+			_stats.idleBytes += size;
+			return;
+		}
+		if (_maxIdleBytes > 0) _stats.discards++;
+	}
+	delete[] buffer;
+}
+
+void ImageBufferPool::countReuse() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stats.reuses++;
+}
+
+image_buffer_pool_stats_t ImageBufferPool::stats() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _stats;
+}
+
+void ImageBufferPool::resetStats() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stats.hits = 0;
+	_stats.misses = 0;
+	_stats.reuses = 0;
+	_stats.discards = 0;
+}
+
+void ImageBufferPool::freeIdle() {
+	for (auto& entry : _idle) {
+		for (auto& idle : entry.second) {
+			delete[] idle.buffer;
+		}
+	}
+	_idle.clear();
+	_stats.idleBuffers = 0;
+	_stats.idleBytes = 0;
+}
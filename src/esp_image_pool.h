@@ -0,0 +1,51 @@
+#ifndef ESP_IMAGE_POOL_H
+#define ESP_IMAGE_POOL_H
+#include <stdint.h>
+#include <stddef.h>
+#include "map"
+#include "vector"
+#include "mutex"
+
+typedef struct {
+    uint32_t hits;          // acquire() was served from an idle buffer
+    uint32_t misses;        // acquire() had to allocate
+    uint32_t reuses;        // An Image reused its own buffer in place
+    uint32_t discards;      // release() freed a buffer because the pool was disabled or full
+    uint32_t idleBuffers;
+    size_t idleBytes;
+} image_buffer_pool_stats_t;
+
+/*
+** Opt-in pool of image buffers so that repeated same-size loads and conversions (e.g. a steady
+** JPEG to RGB565 loop) stop churning and fragmenting the heap/PSRAM.
+** Buffers are grouped in size classes (1/16 steps between powers of two) so frames of similar
+** size share a free list. While disabled acquire() and release() are plain new[] and delete[].
+*/
+class ImageBufferPool {
+    public:
+        static ImageBufferPool& instance();
+        // Start keeping released buffers, holding at most maxIdleBytes of them
+        void enable(size_t maxIdleBytes);
+        // Stop pooling and free all idle buffers
+        void disable();
+        bool enabled() { return _maxIdleBytes > 0; }
+        // Returns a buffer of at least len bytes and its actual size
+        uint8_t* acquire(size_t len, size_t& size);
+        void release(uint8_t* buffer, size_t size);
+        void countReuse();
+        image_buffer_pool_stats_t stats();
+        void resetStats();
+        static size_t sizeClass(size_t len);
+    private:
+        ImageBufferPool() : _maxIdleBytes(0), _stats({ 0, 0, 0, 0, 0, 0 }) {}
+        void freeIdle();
+        typedef struct {
+            uint8_t* buffer;
+            size_t size;
+        } idle_buffer_t;
+        std::mutex _mutex;
+        size_t _maxIdleBytes;
+        std::map<size_t, std::vector<idle_buffer_t>> _idle;
+        image_buffer_pool_stats_t _stats;
+};
+#endif
@@ -0,0 +1,130 @@
+#include "esp_image_resize.h"
+#include <math.h>
+
+namespace image_kernels {
+
+static const int WEIGHT_ONE = 4096;
+
+ResizeTaps::ResizeTaps(int sourceSize, int targetSize, resize_method_t method) :
+    first(targetSize),
+    count(targetSize),
+    offset(targetSize),
+    maxTaps(1) {
+    weights.reserve(method == RESIZE_AREA ? targetSize + sourceSize : 2 * targetSize);
+    for (int i = 0; i < targetSize; i++) {
+        offset[i] = weights.size();
+        if (method == RESIZE_NEAREST) {
+            // Centre of the output pixel, as in ((i + 0.5) * sourceSize / targetSize). 64 bit as for RESIZE_AREA
+            first[i] = (int)(((int64_t)(2 * i + 1) * sourceSize) / (2 * targetSize));
+            count[i] = 1;
+            weights.push_back(WEIGHT_ONE);
+        } else
+        if (method == RESIZE_BILINEAR) {
+            double centre = (i + 0.5) * sourceSize / targetSize - 0.5;
+            if (centre < 0) centre = 0;
+            int left = (int)floor(centre);
+            int fraction = (int)((centre - left) * WEIGHT_ONE + 0.5);
+            if (left >= sourceSize - 1 || fraction == 0) {
+                first[i] = left >= sourceSize - 1 ? sourceSize - 1 : left;
+                count[i] = 1;
+                weights.push_back(WEIGHT_ONE);
+            } else {
+                first[i] = left;
+                count[i] = 2;
+                weights.push_back(WEIGHT_ONE - fraction);
+                weights.push_back(fraction);
+            }
+        } else {
+            // Output i covers [i * sourceSize, (i + 1) * sourceSize) in units of 1 / targetSize input pixels
+            int64_t start = (int64_t)i * sourceSize;
+            int64_t end = start + sourceSize;
+            int firstSource = start / targetSize;
+            int lastSource = (end - 1) / targetSize;
+            first[i] = firstSource;
+            count[i] = lastSource - firstSource + 1;
+            // Each weight is the difference of the rounded cumulative coverage at its ends, so the weights add up
+            // to exactly WEIGHT_ONE and none is negative however many taps there are
+            int covered = 0;
+            for (int s = firstSource; s <= lastSource; s++) {
+                int64_t to = (int64_t)(s + 1) * targetSize < end ? (int64_t)(s + 1) * targetSize : end;
+                int coveredTo = (int)(((to - start) * WEIGHT_ONE + sourceSize / 2) / sourceSize);
+                weights.push_back(coveredTo - covered);
+                covered = coveredTo;
+            }
+        }
+        if (count[i] > maxTaps) maxTaps = count[i];
+    }
+}
+
+void resampleRowNearest(const uint8_t* src, uint8_t* dst, const ResizeTaps& taps, int bytesPerPixel) {
+    int n = taps.first.size();
+    const uint16_t* first = taps.first.data();
+    switch (bytesPerPixel) {
+        case 1:
+            for (int i = 0; i < n; i++) dst[i] = src[first[i]];
+            break;
+        case 2:
+            for (int i = 0; i < n; i++, dst += 2) {
+                const uint8_t* p = src + 2 * first[i];
+                dst[0] = p[0];
+                dst[1] = p[1];
+            }
+            break;
+        default:
+            for (int i = 0; i < n; i++, dst += 3) {
+                const uint8_t* p = src + 3 * first[i];
+                dst[0] = p[0];
+                dst[1] = p[1];
+                dst[2] = p[2];
+            }
+    }
+}
+
+template<int channels>
+static void resampleRowChannels(const uint8_t* src, uint16_t* dst, const ResizeTaps& taps) {
+    int n = taps.first.size();
+    for (int i = 0; i < n; i++, dst += channels) {
+        const uint8_t* p = src + channels * taps.first[i];
+        const uint16_t* w = taps.weights.data() + taps.offset[i];
+        uint32_t sums[channels] = {};
+        if (taps.count[i] == 2) {
+            // The common bilinear case
+            for (int c = 0; c < channels; c++) sums[c] = p[c] * w[0] + p[c + channels] * w[1];
+        } else {
+            for (int t = 0; t < taps.count[i]; t++, p += channels) {
+                for (int c = 0; c < channels; c++) sums[c] += p[c] * w[t];
+            }
+        }
+        for (int c = 0; c < channels; c++) dst[c] = (sums[c] + 128) >> 8;
+    }
+}
+
+void resampleRow(const uint8_t* src, uint16_t* dst, const ResizeTaps& taps, int channels) {
+    if (channels == 1) {
+        resampleRowChannels<1>(src, dst, taps);
+    } else {
+        resampleRowChannels<3>(src, dst, taps);
+    }
+}
+
+void blendRows(const uint16_t* const* rows, const uint16_t* weights, int rowCount, uint8_t* dst, int count) {
+    if (rowCount == 1) {
+        const uint16_t* row = rows[0];
+        for (int i = 0; i < count; i++) dst[i] = (row[i] + 8) >> 4;
+        return;
+    }
+    if (rowCount == 2) {
+        const uint16_t* a = rows[0];
+        const uint16_t* b = rows[1];
+        uint32_t wa = weights[0], wb = weights[1];
+        for (int i = 0; i < count; i++) dst[i] = (a[i] * wa + b[i] * wb + (1 << 15)) >> 16;
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        uint32_t sum = 1 << 15;
+        for (int r = 0; r < rowCount; r++) sum += rows[r][i] * weights[r];
+        dst[i] = sum >> 16;
+    }
+}
+
+} // namespace image_kernels
@@ -0,0 +1,38 @@
+#ifndef ESP_IMAGE_RESIZE_H
+#define ESP_IMAGE_RESIZE_H
+/*
+** Separable fixed point resampling used by Image::resize()
+** Each output column (and row) is a weighted sum of a few neighbouring input columns (rows), its 'taps',
+** with weights in 1/4096ths that add up to 4096. Rows are resampled horizontally into 16 bit
+** intermediates (value * 16) and then blended vertically, so each pass is a plain multiply-accumulate loop.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include "vector"
+
+typedef enum {
+    RESIZE_NEAREST,
+    RESIZE_BILINEAR,
+    RESIZE_AREA         // Average of the covered area, best for shrinking
+} resize_method_t;
+
+namespace image_kernels {
+
+struct ResizeTaps {
+    ResizeTaps(int sourceSize, int targetSize, resize_method_t method);
+    std::vector<uint16_t> first;      // First input index of each output
+    std::vector<uint16_t> count;      // Number of taps of each output
+    std::vector<uint32_t> offset;     // Index of each output's first weight in weights
+    std::vector<uint16_t> weights;
+    int maxTaps;
+};
+
+// Nearest neighbour needs no arithmetic, just a pixel gather of bytesPerPixel at a time
+void resampleRowNearest(const uint8_t* src, uint8_t* dst, const ResizeTaps& taps, int bytesPerPixel);
+// Horizontal pass of 8 bit interleaved channels into value * 16
+void resampleRow(const uint8_t* src, uint16_t* dst, const ResizeTaps& taps, int channels);
+// Vertical pass: dst = sum of rows[i] * weights[i], rounded back to 8 bits
+void blendRows(const uint16_t* const* rows, const uint16_t* weights, int rowCount, uint8_t* dst, int count);
+
+} // namespace image_kernels
+#endif
@@ -0,0 +1,115 @@
+#include "esp_image.h"
+#include "esp_image_kernels.h"
+
+ImageStats::ImageStats(bool channels) :
+	count(0),
+	min(255),
+	max(0),
+	mean(0),
+	variance(0) {
+	memset(histogram, 0, sizeof(histogram));
+	if (channels) {
+		red.assign(256, 0);
+		green.assign(256, 0);
+		blue.assign(256, 0);
+	}
+}
+
+// Accumulate a run of consecutive pixels
+// Only the histograms are updated per pixel, everything else is derived from them by finish()
+void ImageStats::add(image_type_t type, const uint8_t* pixels, int pixelCount, pixel_order_t order) {
+	const uint8_t* p = pixels;
+	// Bytes of a native (little-endian) pixel are the other way round
+	int hi = order == PIXEL_ORDER_NATIVE ? 1 : 0;
+	int lo = 1 - hi;
+	switch (type) {
+		case IMAGE_RGB565:
+			for (int i = 0; i < pixelCount; i++, p += 2) {
+				histogram[(image_kernels::greyTables.hi[p[hi]] + image_kernels::greyTables.lo[p[lo]]) >> 10]++;
+			}
+			if (hasChannels()) {
+				for (p = pixels; p < pixels + 2 * pixelCount; p += 2) {
+					red[p[hi] & 0xF8]++;
+					green[(p[hi] & 0x07) << 5 | (p[lo] & 0xE0) >> 3]++;
+					blue[(p[lo] & 0x1F) << 3]++;
+				}
+			}
+			break;
+		case IMAGE_RGB888:
+		case IMAGE_BMP:
+			// Stored as B G R in memory
+			for (int i = 0; i < pixelCount; i++, p += 3) {
+				histogram[image_kernels::rgbGrey(p[2], p[1], p[0])]++;
+			}
+			if (hasChannels()) {
+				for (p = pixels; p < pixels + 3 * pixelCount; p += 3) {
+					blue[p[0]]++;
+					green[p[1]]++;
+					red[p[2]]++;
+				}
+			}
+			break;
+		case IMAGE_GRAYSCALE8:
+			for (int i = 0; i < pixelCount; i++) {
+				histogram[p[i]]++;
+			}
+			if (hasChannels()) {
+				for (int i = 0; i < pixelCount; i++) {
+					red[p[i]]++;
+					green[p[i]]++;
+					blue[p[i]]++;
+				}
+			}
+			break;
+		default:
+			throw LogicError(StringF("[%s:%d] Cannot gather stats for %s", __FILE__, __LINE__, imageTypeName[type]));
+	}
+}
+
+void ImageStats::merge(const ImageStats& that) {
+	for (int grey = 0; grey < 256; grey++) {
+		histogram[grey] += that.histogram[grey];
+	}
+	if (hasChannels() && that.hasChannels()) {
+		for (int value = 0; value < 256; value++) {
+			red[value] += that.red[value];
+			green[value] += that.green[value];
+			blue[value] += that.blue[value];
+		}
+	}
+}
+
+void ImageStats::finish() {
+	uint64_t sum = 0;
+	uint64_t sumOfSquares = 0;
+	count = 0;
+	min = 255;
+	max = 0;
+	for (int grey = 0; grey < 256; grey++) {
+		uint32_t n = histogram[grey];
+		if (n == 0) continue;
+		if (grey < min) min = grey;
+		max = grey;
+		count += n;
+		sum += (uint64_t)n * grey;
+		sumOfSquares += (uint64_t)n * grey * grey;
+	}
+	if (count == 0) {
+		mean = 0;
+		variance = 0;
+		return;
+	}
+	double m = (double)sum / count;
+	mean = m;
+	variance = (double)sumOfSquares / count - m * m;
+}
+
+int ImageStats::percentile(float fraction) const {
+	uint64_t target = (uint64_t)(fraction * count + 0.5f);
+	uint64_t seen = 0;
+	for (int grey = 0; grey < 256; grey++) {
+		seen += histogram[grey];
+		if (seen >= target && seen > 0) return grey;
+	}
+	return max;
+}
@@ -0,0 +1,130 @@
+#include "esp_image_writer.h"
+#ifdef ESP_PLATFORM
+#include "esp_pthread.h"
+#endif
+
+ImageWriter::ImageWriter(size_t queueLength, writer_full_policy_t policy, size_t stackSize) :
+	_queueLength(queueLength > 0 ? queueLength : 1),
+	_policy(policy),
+	_writing(false),
+	_stopping(false),
+	_stats({ 0, 0, 0, 0, 0, 0, 0, 0, 0 }) {
+#ifdef ESP_PLATFORM
+	// std::thread takes its stack size and name from the pthread config of the creating task, so that config is put
+	// back afterwards for the task's later threads. Left as the default if the task has none
+	esp_pthread_cfg_t previous = esp_pthread_get_default_config();
+	esp_pthread_get_cfg(&previous);
+	esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+	cfg.stack_size = stackSize;
+	cfg.thread_name = "ImageWriter";
+	esp_pthread_set_cfg(&cfg);
+#endif
+	_thread = std::thread(&ImageWriter::run, this);
+#ifdef ESP_PLATFORM
+	esp_pthread_set_cfg(&previous);
+#endif
+}
+
+ImageWriter::~ImageWriter() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_changed.notify_all();
+	_thread.join();
+}
+
+bool ImageWriter::write(Image& image, FS& fs, const String& path, image_write_callback_t callback, existing_image_file_on_save_t existingFileOption) {
+	image.detach();
+	job_t job = { std::move(image), &fs, path, existingFileOption, callback };
+	job_t dropped = { Image(), nullptr, "", OVERWRITE_EXISTING_IMAGE_FILE, nullptr };
+	bool accepted = true;
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (_queue.size() >= _queueLength) {
+			// From a callback on the writer task waiting would never end, as only that task makes room
+			if (_policy == WRITER_BLOCK && std::this_thread::get_id() != _thread.get_id()) {
+				_stats.blocked++;
+				_changed.wait(lock, [this] { return _queue.size() < _queueLength; });
+			} else
+			if (_policy == WRITER_DROP_OLDEST) {
+				dropped = std::move(_queue.front());
+				_queue.pop_front();
+				_stats.dropped++;
+			} else {
+				dropped = std::move(job);
+				_stats.dropped++;
+				accepted = false;
+			}
+		}
+		if (accepted) {
+			_queue.push_back(std::move(job));
+			_stats.queued++;
+			_stats.depth = _queue.size();
+			if (_stats.depth > _stats.maxDepth) _stats.maxDepth = _stats.depth;
+		}
+	}
+	_changed.notify_all();
+	// Outside the lock, so the callback can write() again
+	if (dropped.callback) {
+		dropped.callback(dropped.image, dropped.path, IMAGE_DROPPED, "");
+	}
+	return accepted;
+}
+
+void ImageWriter::flush() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_changed.wait(lock, [this] { return _queue.empty() && !_writing; });
+}
+
+image_writer_stats_t ImageWriter::stats() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _stats;
+}
+
+void ImageWriter::resetStats() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stats = { 0, 0, 0, 0, 0, (uint32_t)_queue.size(), (uint32_t)_queue.size(), 0, 0 };
+}
+
+void ImageWriter::run() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_changed.wait(lock, [this] { return !_queue.empty() || _stopping; });
+		if (_queue.empty()) {
+			return;
+		}
+		job_t job = std::move(_queue.front());
+		_queue.pop_front();
+		_stats.depth = _queue.size();
+		_writing = true;
+		lock.unlock();
+		// Room for another image
+		_changed.notify_all();
+		String error;
+		unsigned long start = micros();
+		// An exception must not escape the thread, so it is handed to the callback instead
+		try {
+			job.image.toFile(*job.fs, job.path).save(job.existingFileOption);
+		} catch (const std::exception& e) {
+			error = e.what();
+		}
+		uint32_t elapsed = micros() - start;
+		//log_i("ImageWriter: %s written in %d us", job.path.c_str(), elapsed);
+		if (job.callback) {
+			job.callback(job.image, job.path, error == "" ? IMAGE_WRITTEN : IMAGE_WRITE_FAILED, error);
+		}
+		// Back to the pool before flush() returns
+		job.image.clear();
+		lock.lock();
+		_writing = false;
+		if (error == "") {
+			_stats.written++;
+		} else {
+			_stats.failed++;
+		}
+		if (elapsed > _stats.longestWriteMicros) _stats.longestWriteMicros = elapsed;
+		_stats.totalWriteMicros += elapsed;
+		_changed.notify_all();
+	}
+}
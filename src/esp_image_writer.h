@@ -0,0 +1,83 @@
+#ifndef ESP_IMAGE_WRITER_H
+#define ESP_IMAGE_WRITER_H
+#include "esp_image.h"
+#include "deque"
+#include "mutex"
+#include "condition_variable"
+#include "thread"
+#include "functional"
+
+// Stack of the writer task on the ESP32, enough for the file system calls in save()
+static const size_t IMAGE_WRITER_STACK_SIZE = 8192;
+
+typedef enum {
+    WRITER_BLOCK,           // write() waits for room in the queue
+    WRITER_DROP_OLDEST,     // The longest waiting image is discarded to make room
+    WRITER_DROP_NEWEST      // The image given to write() is discarded
+} writer_full_policy_t;
+
+typedef enum {
+    IMAGE_WRITTEN,
+    IMAGE_WRITE_FAILED,     // save() threw, error says why
+    IMAGE_DROPPED           // Discarded because the queue was full
+} image_write_result_t;
+
+// Called on the writer task once an image is written or has failed, or on the caller of write() when it is dropped.
+// The image is destroyed when the callback returns, unless it is moved from. Must not throw. It may write() again, but
+// with WRITER_BLOCK and the queue full that image is dropped, as the writer task cannot wait for itself
+typedef std::function<void(Image& image, const String& path, image_write_result_t result, const String& error)> image_write_callback_t;
+
+typedef struct {
+    uint32_t queued;            // Images accepted by write()
+    uint32_t written;
+    uint32_t failed;
+    uint32_t dropped;
+    uint32_t blocked;           // write() calls that had to wait for room
+    uint32_t depth;             // Images waiting now, not counting one being written
+    uint32_t maxDepth;
+    uint32_t longestWriteMicros;
+    uint64_t totalWriteMicros;
+} image_writer_stats_t;
+
+/*
+** Saves Images on a task of its own so that a capture loop is not held up by slow storage.
+** write() takes the image's buffer (pooled buffers go back to the ImageBufferPool once written) and queues it;
+** the writer task does the toFile().save(), mkdirs and metadata included, in the order they were queued.
+** The queue is bounded: what happens when it is full is set by the writer_full_policy_t.
+** Runs on std::thread, which is a FreeRTOS task on the ESP32.
+*/
+class ImageWriter {
+    public:
+        ImageWriter(size_t queueLength = 4, writer_full_policy_t policy = WRITER_BLOCK, size_t stackSize = IMAGE_WRITER_STACK_SIZE);
+        ImageWriter(const ImageWriter&) = delete;
+        ImageWriter& operator=(const ImageWriter&) = delete;
+        // Writes everything still queued before returning
+        ~ImageWriter();
+        // Queue image to be saved as path on fs, leaving image empty. A view is copied first, as its source may not
+        // outlive the write. Returns false if it was dropped (WRITER_DROP_NEWEST with the queue full, or WRITER_BLOCK
+        // from a callback with the queue full)
+        bool write(Image& image, FS& fs, const String& path, image_write_callback_t callback = nullptr, existing_image_file_on_save_t existingFileOption = OVERWRITE_EXISTING_IMAGE_FILE);
+        // Wait until everything queued so far has been written
+        void flush();
+        image_writer_stats_t stats();
+        void resetStats();
+    private:
+        typedef struct Job {
+            Image image;
+            FS* fs;
+            String path;
+            existing_image_file_on_save_t existingFileOption;
+            image_write_callback_t callback;
+        } job_t;
+        void run();
+        size_t _queueLength;
+        writer_full_policy_t _policy;
+        std::mutex _mutex;
+        std::condition_variable _changed;   // A job was queued or finished, or the writer is stopping
+        std::deque<job_t> _queue;
+        bool _writing;
+        bool _stopping;
+        image_writer_stats_t _stats;
+        std::thread _thread;
+};
+#endif